@@ -6,7 +6,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <unordered_map>
@@ -73,6 +75,26 @@ int main(int argc, char* argv[]) {
          "Whether to use 32-bit indices.")
       ->type_name("(never|auto|always)");
 
+  app.add_option(
+         "--skin-weights",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string choice : choices) {
+             if (choice == "float") {
+               gltfOptions.skinWeights = SkinWeightsOptions::FLOAT;
+             } else if (choice == "ushort") {
+               gltfOptions.skinWeights = SkinWeightsOptions::USHORT;
+             } else if (choice == "ubyte") {
+               gltfOptions.skinWeights = SkinWeightsOptions::UBYTE;
+             } else {
+               fmt::printf("Unknown --skin-weights: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           return true;
+         },
+         "How to store the joint weights of skinned vertices.")
+      ->type_name("(float|ushort|ubyte)");
+
   app.add_option(
          "--compute-normals",
          [&](std::vector<std::string> choices) -> bool {
@@ -95,6 +117,77 @@ int main(int argc, char* argv[]) {
          "When to compute vertex normals from mesh geometry.")
       ->type_name("(never|broken|missing|always)");
 
+  app.add_option(
+         "--normal-weighting",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string choice : choices) {
+             if (choice == "angle") {
+               gltfOptions.normalWeighting = NormalWeightingOption::ANGLE;
+             } else if (choice == "area") {
+               gltfOptions.normalWeighting = NormalWeightingOption::AREA;
+             } else if (choice == "uniform") {
+               gltfOptions.normalWeighting = NormalWeightingOption::UNIFORM;
+             } else {
+               fmt::printf("Unknown --normal-weighting option: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           return true;
+         },
+         "How to weigh the faces around a vertex when computing its normal; uniform by default.")
+      ->type_name("(uniform|angle|area)");
+
+  app.add_option(
+         "--normal-smoothing-angle",
+         gltfOptions.normalSmoothingAngle,
+         "Keep a hard edge between faces further apart than this in computed normals.",
+         true)
+      ->check(CLI::Range(0.0f, 180.0f));
+
+  app.add_flag(
+      "--optimize-vertex-cache",
+      gltfOptions.optimizeVertexCache,
+      "Reorder triangles for the GPU's post-transform vertex cache.");
+
+  app.add_flag(
+      "--optimize-vertex-fetch",
+      gltfOptions.optimizeVertexFetch,
+      "Renumber vertices in the order triangles first use them, e.g. after reordering those.");
+
+  app.add_option(
+         "--lod",
+         gltfOptions.lodRatios,
+         "Add a simplified level of detail keeping this fraction of triangles. Repeatable.")
+      ->expected(1)
+      ->check(CLI::Range(0.0f, 1.0f));
+
+  app.add_flag(
+         "--weld",
+         gltfOptions.weld.enabled,
+         "Weld vertices that differ by no more than the tolerances below, e.g. float noise.")
+      ->group("Welding");
+
+  app.add_option(
+         "--weld-position",
+         gltfOptions.weld.position,
+         "How far apart welded positions may be, as a fraction of their mesh's size.",
+         true)
+      ->check(CLI::Range(0.0f, 0.01f))
+      ->group("Welding");
+
+  app.add_option(
+         "--weld-normal-angle",
+         gltfOptions.weld.normalAngle,
+         "How many degrees apart welded normals, tangents and binormals may point.",
+         true)
+      ->check(CLI::Range(0.0f, 180.0f))
+      ->group("Welding");
+
+  app.add_option(
+         "--weld-uv", gltfOptions.weld.uv, "How far apart welded UV coordinates may be.", true)
+      ->check(CLI::Range(0.0f, 1.0f))
+      ->group("Welding");
+
   app.add_option(
          "--anim-framerate",
          [&](std::vector<std::string> choices) -> bool {
@@ -115,6 +208,11 @@ int main(int argc, char* argv[]) {
          "Select baked animation framerate.")
       ->type_name("(bake24|bake30|bake60)");
 
+  app.add_flag(
+      "--anim-quantize",
+      gltfOptions.quantizeAnimations,
+      "Store animated rotations and blend shape weights as normalized 16- or 8-bit integers.");
+
   const auto opt_flip_u = app.add_flag("--flip-u", "Flip all U texture coordinates.");
   const auto opt_no_flip_u = app.add_flag("--no-flip-u", "Don't flip U texture coordinates.");
   const auto opt_flip_v = app.add_flag("--flip-v", "Flip all V texture coordinates.");
@@ -152,6 +250,13 @@ int main(int argc, char* argv[]) {
       gltfOptions.useBlendShapeTangents,
       "Include blend shape tangents, if reported present by the FBX SDK.");
 
+  app.add_option(
+         "--blend-shape-sparse-threshold",
+         gltfOptions.blendShapeSparseThreshold,
+         "Write blend shape deltas that move fewer than this fraction of vertices sparsely.",
+         true)
+      ->check(CLI::Range(0.0f, 1.0f));
+
   app.add_option(
          "-k,--keep-attribute",
          [&](std::vector<std::string> attributes) -> bool {
@@ -185,6 +290,88 @@ int main(int argc, char* argv[]) {
       ->type_size(-1)
       ->type_name("(position|normal|tangent|binormial|color|uv0|uv1|auto)");
 
+  app.add_flag_function(
+      "--no-prune-attributes",
+      [&](size_t count) { gltfOptions.pruneAttributes = (count == 0); },
+      "Don't drop constant or unused vertex attributes, nor share duplicate UV sets.");
+
+  app.add_option(
+         "--texture-max-size",
+         gltfOptions.textureResize.maxSize,
+         "Downscale textures so that neither dimension exceeds this many pixels.")
+      ->check(CLI::Range(1, 1 << 16))
+      ->group("Textures");
+
+  app.add_flag(
+         "--texture-pot",
+         gltfOptions.textureResize.powerOfTwo,
+         "Downscale texture dimensions to the nearest power of two.")
+      ->group("Textures");
+
+  app.add_option(
+         "--texture-budget",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string choice : choices) {
+             if (!StringUtils::ParseByteSize(choice, gltfOptions.textureResize.budget)) {
+               fmt::printf("Unknown --texture-budget size: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           return true;
+         },
+         "Downscale the largest textures until all of them fit in this much GPU memory.")
+      ->type_name("SIZE")
+      ->group("Textures");
+
+  app.add_option(
+         "--ktx2",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string choice : choices) {
+             if (choice == "etc1s") {
+               gltfOptions.ktx2.uastc = false;
+             } else if (choice == "uastc") {
+               gltfOptions.ktx2.uastc = true;
+             } else {
+               fmt::printf("Unknown --ktx2 codec: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           gltfOptions.ktx2.enabled = true;
+           return true;
+         },
+         "Transcode all textures to KTX2 with Basis Universal, using KHR_texture_basisu.")
+      ->type_name("(etc1s|uastc)")
+      ->group("Textures");
+
+  app.add_flag(
+         "--ktx2-mipmaps",
+         gltfOptions.ktx2.mipmaps,
+         "Generate a full mip chain for each KTX2 texture.")
+      ->group("Textures");
+
+  app.add_option(
+         "--texture-link",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string choice : choices) {
+             if (choice == "copy") {
+               gltfOptions.textureLink = TextureLinkOptions::COPY;
+             } else if (choice == "hardlink") {
+               gltfOptions.textureLink = TextureLinkOptions::HARDLINK;
+             } else if (choice == "reflink") {
+               gltfOptions.textureLink = TextureLinkOptions::REFLINK;
+             } else if (choice == "symlink") {
+               gltfOptions.textureLink = TextureLinkOptions::SYMLINK;
+             } else {
+               fmt::printf("Unknown --texture-link option: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           return true;
+         },
+         "How to put unaltered textures in the output folder of a .gltf.")
+      ->type_name("(copy|hardlink|reflink|symlink)")
+      ->group("Textures");
+
   app.add_flag(
          "-d,--draco", gltfOptions.draco.enabled, "Apply Draco mesh compression to geometries.")
       ->group("Draco");
@@ -237,6 +424,16 @@ int main(int argc, char* argv[]) {
       ->check(CLI::Range(1, 32))
       ->group("Draco");
 
+  app.add_flag(
+      "--meshopt",
+      gltfOptions.useMeshopt,
+      "Apply EXT_meshopt_compression to geometries, morph targets and animations.");
+
+  app.add_flag(
+      "--mesh-quantize",
+      gltfOptions.quantizeMeshes,
+      "Store vertex attributes as 16- or 8-bit integers, using KHR_mesh_quantization.");
+
   app.add_option("--fbx-temp-dir", gltfOptions.fbxTempDir, "Temporary directory to be used by FBX SDK.")->check(CLI::ExistingDirectory);
 
   CLI11_PARSE(app, argc, argv);
@@ -282,6 +479,15 @@ int main(int argc, char* argv[]) {
   if (gltfOptions.embedResources && gltfOptions.outputBinary) {
     fmt::printf("Note: Ignoring --embed; it's meaningless with --binary.\n");
   }
+  if (gltfOptions.quantizeMeshes && gltfOptions.draco.enabled) {
+    fmt::printf("Note: Ignoring --mesh-quantize; Draco quantizes meshes its own way.\n");
+    gltfOptions.quantizeMeshes = false;
+  }
+  // levels of detail go from the most detailed to the least; each must keep fewer triangles
+  std::vector<float>& lodRatios = gltfOptions.lodRatios;
+  std::sort(lodRatios.begin(), lodRatios.end(), std::greater<float>());
+  lodRatios.erase(std::unique(lodRatios.begin(), lodRatios.end()), lodRatios.end());
+  lodRatios.erase(std::remove(lodRatios.begin(), lodRatios.end(), 1.0f), lodRatios.end());
 
   if (outputPath.empty()) {
     // if -o is not given, default to the basename of the .fbx
@@ -334,8 +540,11 @@ int main(int argc, char* argv[]) {
   if (!texturesTransforms.empty()) {
     raw.TransformTextures(texturesTransforms);
   }
+  // degenerate triangles would skew computed normals
+  raw.CleanTriangles();
   raw.Condense();
-  raw.TransformGeometry(gltfOptions.computeNormals);
+  raw.TransformGeometry(
+      gltfOptions.computeNormals, gltfOptions.normalWeighting, gltfOptions.normalSmoothingAngle);
 
   std::ofstream outStream; // note: auto-flushes in destructor
   const auto streamStart = outStream.tellp();
@@ -377,9 +586,8 @@ int main(int argc, char* argv[]) {
   }
 
   if (data_render_model->binary->empty() == false) {
-    const unsigned char* binaryData = &(*data_render_model->binary)[0];
     unsigned long binarySize = data_render_model->binary->size();
-    if (fwrite(binaryData, binarySize, 1, fp) != 1) {
+    if (!data_render_model->binary->writeTo(fp)) {
       fmt::fprintf(
           stderr, "ERROR: Failed to write %lu bytes to file '%s'.\n", binarySize, binaryPath);
       fclose(fp);
@@ -10,6 +10,7 @@
 
 #include <climits>
 #include <string>
+#include <vector>
 
 #if defined(_WIN32)
 // Tell Windows not to define min() and max() macros
@@ -62,18 +63,40 @@ enum class ComputeNormalsOption {
   ALWAYS // compute a new normal for every vertex, obliterating whatever may have been there before
 };
 
+/**
+ * How much each face around a vertex counts towards the vertex's computed normal.
+ */
+enum class NormalWeightingOption {
+  ANGLE, // by the face's angle at the vertex, so that how polygons were triangulated doesn't matter
+  AREA, // by the face's area, so that small faces barely count
+  UNIFORM // all faces count the same
+};
+
 enum class UseLongIndicesOptions {
   NEVER, // only ever use 16-bit indices
   AUTO, // use shorts or longs depending on vertex count
   ALWAYS, // only ever use 32-bit indices
 };
 
+enum class SkinWeightsOptions {
+  FLOAT, // write joint weights as floats
+  USHORT, // write them as normalized 16-bit integers
+  UBYTE, // write them as normalized 8-bit integers
+};
+
 enum class AnimationFramerateOptions {
   BAKE24, // bake animations at 24 fps
   BAKE30, // bake animations at 30 fps
   BAKE60, // bake animations at 60 fps
 };
 
+enum class TextureLinkOptions {
+  COPY, // copy source textures into the output folder
+  HARDLINK, // hard-link them into it, copying only across file systems
+  REFLINK, // clone them copy-on-write, where the file system supports it; else copy
+  SYMLINK, // symlink them by absolute path; else copy
+};
+
 /**
  * User-supplied options that dictate the nature of the glTF being generated.
  */
@@ -101,6 +124,38 @@ struct GltfOptions {
     int quantBitsGeneric = 8;
   } draco;
 
+  /**
+   * Whether to use EXT_meshopt_compression for geometry, morph targets and animations: a denser
+   * encoding than plain binary that decodes much faster than Draco.
+   */
+  bool useMeshopt{false};
+  /**
+   * Whether to store positions, normals, tangents, UVs and blend shape deltas as (normalized)
+   * integers, using KHR_mesh_quantization. Draco does its own quantization, and overrides this.
+   */
+  bool quantizeMeshes{false};
+
+  /** Whether and how to shrink textures on their way into the glTF. */
+  struct {
+    /** If positive, no texture dimension may exceed this many pixels. */
+    int maxSize = 0;
+    /** Whether to round texture dimensions down to the nearest power of two. */
+    bool powerOfTwo = false;
+    /** If positive, the GPU memory (in bytes, mipmaps included) all textures must fit into. */
+    uint64_t budget = 0;
+  } textureResize;
+
+  /** Whether and how to transcode all textures to KTX2, for KHR_texture_basisu. */
+  struct {
+    bool enabled = false;
+    /** Whether to use the UASTC codec rather than ETC1S. */
+    bool uastc = false;
+    /** Whether to generate a full mip chain for each texture. */
+    bool mipmaps = false;
+  } ktx2;
+  /** How unaltered source textures find their way into a .gltf's output folder. */
+  TextureLinkOptions textureLink = TextureLinkOptions::COPY;
+
   /** Whether to include FBX User Properties as 'extras' metadata in glTF nodes. */
   bool enableUserProperties{false};
 
@@ -116,12 +171,52 @@ struct GltfOptions {
   bool useBlendShapeNormals{false};
   /** Whether to include blend shape tangents, if present according to the SDK. */
   bool useBlendShapeTangents{false};
+  /**
+   * Blend shape deltas that move fewer than this fraction of a mesh's vertices are written as
+   * sparse accessors. Zero means never.
+   */
+  float blendShapeSparseThreshold{0.25f};
   /** When to compute vertex normals from geometry. */
   ComputeNormalsOption computeNormals = ComputeNormalsOption::BROKEN;
+  /** How to weigh the faces around a vertex when computing its normal; by default, all alike. */
+  NormalWeightingOption normalWeighting = NormalWeightingOption::UNIFORM;
+  /**
+   * Faces whose normals are further apart than this many degrees don't smooth each other's computed
+   * normals, leaving a hard edge between them. 180 smooths everything.
+   */
+  float normalSmoothingAngle{180.0f};
   /** When to use 32-bit indices. */
   UseLongIndicesOptions useLongIndices = UseLongIndicesOptions::AUTO;
+  /**
+   * Whether to drop vertex attributes a primitive can do without, such as all-white vertex colors
+   * or tangents without a normal map, and share a second UV set that copies the first.
+   */
+  bool pruneAttributes{true};
+  /** How to write skinned vertices' joint weights; joint indices are bytes whenever they fit. */
+  SkinWeightsOptions skinWeights = SkinWeightsOptions::USHORT;
+  /** Whether and how to weld the near-identical vertices FBX exports are often full of. */
+  struct {
+    bool enabled = false;
+    /** How far apart positions may be, as a fraction of their mesh's bounding box diagonal. */
+    float position = 1e-5f;
+    /** How many degrees apart normals, tangents and binormals may point. */
+    float normalAngle = 1.0f;
+    /** How far apart UV coordinates may be. */
+    float uv = 1e-4f;
+  } weld;
+  /** Whether to reorder each primitive's triangles for the GPU's post-transform vertex cache. */
+  bool optimizeVertexCache{false};
+  /** Whether to renumber each primitive's vertices in the order its triangles first use them. */
+  bool optimizeVertexFetch{false};
+  /**
+   * For each simplified level of detail to generate, the fraction of each mesh's triangles it
+   * keeps, in descending order. The levels are tied to their full meshes with MSFT_lod.
+   */
+  std::vector<float> lodRatios;
   /** Select baked animation framerate. */
   AnimationFramerateOptions animationFramerate = AnimationFramerateOptions::BAKE24;
+  /** Whether to store animated rotations and blend shape weights as normalized integers. */
+  bool quantizeAnimations{false};
 
   /** Temporary directory used by FBX SDK. */
   std::string fbxTempDir;
@@ -740,6 +740,119 @@ static void ReadNodeHierarchy(
   }
 }
 
+/**
+ * Append one weight per target shape of a blend channel, given the channel's influence (0-100).
+ * The target shape 'fullWeight' values are a strictly ascending list of floats (between 0 and 100),
+ * forming a sequence of intervals: the influence transitions into one target and away from the one
+ * before it, and every other target gets a weight of zero. Returns false if no target was reached.
+ */
+static bool AppendTargetWeights(
+    const double influence,
+    const std::vector<double>& fullWeights,
+    std::vector<float>& weights) {
+  const int targetCount = static_cast<int>(fullWeights.size());
+
+  // figures out if 'p' lays between the fullWeights of targets n and n + 1, and if so where
+  auto findInInterval = [&](const double p, const int n) {
+    if (n >= targetCount) {
+      // p is certainly completely left of this interval
+      return NAN;
+    }
+    double leftWeight = 0;
+    if (n >= 0) {
+      leftWeight = fullWeights[n];
+      if (p < leftWeight) {
+        return NAN;
+      }
+      // the first interval implicitly includes all lesser influence values
+    }
+    double rightWeight = fullWeights[n + 1];
+    if (p > rightWeight && n + 1 < targetCount - 1) {
+      return NAN;
+      // the last interval implicitly includes all greater influence values
+    }
+    // transform p linearly such that [leftWeight, rightWeight] => [0, 1]
+    return static_cast<float>((p - leftWeight) / (rightWeight - leftWeight));
+  };
+
+  bool reached = false;
+  for (int targetIx = 0; targetIx < targetCount; targetIx++) {
+    float result = findInInterval(influence, targetIx - 1);
+    if (!std::isnan(result)) {
+      // we're transitioning into targetIx
+      weights.push_back(result);
+      reached = true;
+      continue;
+    }
+    if (targetIx != targetCount - 1) {
+      result = findInInterval(influence, targetIx);
+      if (!std::isnan(result)) {
+        // we're transitioning AWAY from targetIx
+        weights.push_back(1.0f - result);
+        reached = true;
+        continue;
+      }
+    }
+    weights.push_back(0.0f);
+  }
+  return reached;
+}
+
+/**
+ * Pick the frames of a baked weights track to keep, such that linearly interpolating between
+ * them reproduces every dropped frame to within the tolerance. The track holds 'stride' weights
+ * per frame; a frame is only dropped if all of them can be. This is the "swing door" algorithm:
+ * from the last kept frame, each further frame narrows the range of slopes that would still pass
+ * within tolerance of it, and the segment ends at the first frame whose own slope falls outside.
+ */
+static std::vector<size_t> ReduceWeightKeys(
+    const std::vector<float>& times,
+    const std::vector<float>& weights,
+    const size_t stride,
+    const float tolerance) {
+  const size_t frameCount = times.size();
+  std::vector<size_t> kept;
+  if (frameCount <= 2 || stride == 0) {
+    for (size_t frameIx = 0; frameIx < frameCount; frameIx++) {
+      kept.push_back(frameIx);
+    }
+    return kept;
+  }
+
+  std::vector<float> minSlopes(stride), maxSlopes(stride);
+  auto startSegment = [&](size_t anchor) {
+    kept.push_back(anchor);
+    std::fill(minSlopes.begin(), minSlopes.end(), -INFINITY);
+    std::fill(maxSlopes.begin(), maxSlopes.end(), INFINITY);
+  };
+
+  startSegment(0);
+  for (size_t frameIx = 1; frameIx < frameCount; frameIx++) {
+    size_t anchor = kept.back();
+    if (frameIx > anchor + 1) {
+      // can the segment reach this frame without straying from any of the ones it skips?
+      const float dt = times[frameIx] - times[anchor];
+      for (size_t ix = 0; ix < stride; ix++) {
+        const float slope = (weights[frameIx * stride + ix] - weights[anchor * stride + ix]) / dt;
+        if (slope < minSlopes[ix] || slope > maxSlopes[ix]) {
+          startSegment(frameIx - 1);
+          anchor = frameIx - 1;
+          break;
+        }
+      }
+    }
+    // this frame now constrains every later end point of the segment
+    const float dt = times[frameIx] - times[anchor];
+    for (size_t ix = 0; ix < stride; ix++) {
+      const float delta = weights[frameIx * stride + ix] - weights[anchor * stride + ix];
+      minSlopes[ix] = std::max(minSlopes[ix], (delta - tolerance) / dt);
+      maxSlopes[ix] = std::min(maxSlopes[ix], (delta + tolerance) / dt);
+    }
+  }
+  kept.push_back(frameCount - 1);
+  return kept;
+}
+
 static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& options) {
   FbxTime::EMode eMode = FbxTime::eFrames24;
   switch (options.animationFramerate) {
@@ -754,6 +867,8 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
       break;
   }
   const double epsilon = 1e-5f;
+  // how far a blend shape weight (0-1) may stray from its baked value when keyframes are dropped
+  const float weightTolerance = 1e-4f;
 
   const int animationCount = pScene->GetSrcObjectCount<FbxAnimStack>();
   for (size_t animIx = 0; animIx < animationCount; animIx++) {
@@ -866,72 +981,66 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
         channel.scales.push_back(toVec3f(localScale));
       }
 
-      std::vector<FbxAnimCurve*> shapeAnimCurves;
       FbxNodeAttribute* nodeAttr = pNode->GetNodeAttribute();
       if (nodeAttr != nullptr && nodeAttr->GetAttributeType() == FbxNodeAttribute::EType::eMesh) {
         // it's inelegant to recreate this same access class multiple times, but it's also dirt
         // cheap...
         FbxBlendShapesAccess blendShapes(static_cast<FbxMesh*>(nodeAttr));
 
-        for (FbxLongLong frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex; frameIndex++) {
-          FbxTime pTime;
-          pTime.SetFrame(frameIndex, eMode);
-
-          for (size_t channelIx = 0; channelIx < blendShapes.GetChannelCount(); channelIx++) {
-            FbxAnimCurve* curve = blendShapes.GetAnimation(channelIx, animIx);
-            float influence = (curve != nullptr) ? curve->Evaluate(pTime) : 0; // 0-100
-
-            int targetCount = static_cast<int>(blendShapes.GetTargetShapeCount(channelIx));
+        // look up each channel's curve and target breakpoints once, rather than once per frame
+        const size_t channelCount = blendShapes.GetChannelCount();
+        std::vector<FbxAnimCurve*> shapeAnimCurves(channelCount);
+        std::vector<std::vector<double>> fullWeights(channelCount);
+        size_t targetCount = 0;
+        bool hasCurves = false;
+        for (size_t channelIx = 0; channelIx < channelCount; channelIx++) {
+          shapeAnimCurves[channelIx] = blendShapes.GetAnimation(channelIx, animIx);
+          hasCurves |= (shapeAnimCurves[channelIx] != nullptr);
+          for (size_t targetIx = 0; targetIx < blendShapes.GetTargetShapeCount(channelIx);
+               targetIx++) {
+            fullWeights[channelIx].push_back(
+                blendShapes.GetTargetShape(channelIx, targetIx).fullWeight);
+          }
+          targetCount += fullWeights[channelIx].size();
+        }
 
-            // the target shape 'fullWeight' values are a strictly ascending list of floats (between
-            // 0 and 100), forming a sequence of intervals -- this convenience function figures out
-            // if 'p' lays between some certain target fullWeights, and if so where (from 0 to 1).
-            auto findInInterval = [&](const double p, const int n) {
-              if (n >= targetCount) {
-                // p is certainly completely left of this interval
-                return NAN;
-              }
-              double leftWeight = 0;
-              if (n >= 0) {
-                leftWeight = blendShapes.GetTargetShape(channelIx, n).fullWeight;
-                if (p < leftWeight) {
-                  return NAN;
-                }
-                // the first interval implicitly includes all lesser influence values
-              }
-              double rightWeight = blendShapes.GetTargetShape(channelIx, n + 1).fullWeight;
-              if (p > rightWeight && n + 1 < targetCount - 1) {
-                return NAN;
-                // the last interval implicitly includes all greater influence values
-              }
-              // transform p linearly such that [leftWeight, rightWeight] => [0, 1]
-              return static_cast<float>((p - leftWeight) / (rightWeight - leftWeight));
-            };
-
-            for (int targetIx = 0; targetIx < targetCount; targetIx++) {
-              if (curve) {
-                float result = findInInterval(influence, targetIx - 1);
-                if (!std::isnan(result)) {
-                  // we're transitioning into targetIx
-                  channel.weights.push_back(result);
-                  hasMorphs = true;
-                  continue;
-                }
-                if (targetIx != targetCount - 1) {
-                  result = findInInterval(influence, targetIx);
-                  if (!std::isnan(result)) {
-                    // we're transitioning AWAY from targetIx
-                    channel.weights.push_back(1.0f - result);
-                    hasMorphs = true;
-                    continue;
-                  }
-                }
+        if (hasCurves) {
+          channel.weights.reserve(animation.times.size() * targetCount);
+          for (FbxLongLong frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex;
+               frameIndex++) {
+            FbxTime pTime;
+            pTime.SetFrame(frameIndex, eMode);
+
+            for (size_t channelIx = 0; channelIx < channelCount; channelIx++) {
+              FbxAnimCurve* curve = shapeAnimCurves[channelIx];
+              if (curve != nullptr) {
+                float influence = curve->Evaluate(pTime); // 0-100
+                hasMorphs |=
+                    AppendTargetWeights(influence, fullWeights[channelIx], channel.weights);
+              } else {
+                // we have to fill in a weight for every channelIx/targetIx permutation, regardless
+                // of whether or not they participate in this animation.
+                channel.weights.insert(channel.weights.end(), fullWeights[channelIx].size(), 0.0f);
               }
+            }
+          }
+        }
 
-              // this is here because we have to fill in a weight for every channelIx/targetIx
-              // permutation, regardless of whether or not they participate in this animation.
-              channel.weights.push_back(0.0f);
+        if (hasMorphs) {
+          // baked weights tend to hold still, or move in straight lines, for long stretches
+          const std::vector<size_t> keptFrames =
+              ReduceWeightKeys(animation.times, channel.weights, targetCount, weightTolerance);
+          if (keptFrames.size() < animation.times.size()) {
+            std::vector<float> weights;
+            weights.reserve(keptFrames.size() * targetCount);
+            for (const size_t frameIx : keptFrames) {
+              channel.weightTimes.push_back(animation.times[frameIx]);
+              weights.insert(
+                  weights.end(),
+                  channel.weights.begin() + frameIx * targetCount,
+                  channel.weights.begin() + (frameIx + 1) * targetCount);
             }
+            channel.weights = std::move(weights);
           }
         }
       }
@@ -948,6 +1057,7 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
         }
         if (!hasMorphs) {
           channel.weights.clear();
+          channel.weightTimes.clear();
         }
 
         animation.channels.emplace_back(channel);
@@ -955,7 +1065,8 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
         totalSizeInBytes += channel.translations.size() * sizeof(channel.translations[0]) +
             channel.rotations.size() * sizeof(channel.rotations[0]) +
             channel.scales.size() * sizeof(channel.scales[0]) +
-            channel.weights.size() * sizeof(channel.weights[0]);
+            channel.weights.size() * sizeof(channel.weights[0]) +
+            channel.weightTimes.size() * sizeof(channel.weightTimes[0]);
       }
 
       if (verboseOutput) {
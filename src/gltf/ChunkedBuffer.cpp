@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ChunkedBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fmt/printf.h>
+
+ChunkedBuffer::ChunkedBuffer(size_t arenaSize)
+    : arenaSize(arenaSize), arenaUsed(0), arenaCapacity(0), totalSize(0), largestDeferred(0) {}
+
+void ChunkedBuffer::reserve(size_t bytes) {
+  if (arenaCapacity - arenaUsed >= bytes) {
+    return;
+  }
+  if (!arenas.empty() && arenaUsed == 0) {
+    // never leave an untouched arena behind
+    arenas.pop_back();
+  }
+  arenaCapacity = std::max(arenaSize, bytes);
+  arenaUsed = 0;
+  arenas.emplace_back(new uint8_t[arenaCapacity]);
+}
+
+uint8_t* ChunkedBuffer::grow(size_t bytes) {
+  reserve(bytes);
+  uint8_t* result = arenas.back().get() + arenaUsed;
+  arenaUsed += bytes;
+
+  // extend the last segment if these bytes immediately follow it in memory, too
+  if (!segments.empty() && segments.back().data != nullptr &&
+      segments.back().data + segments.back().length == result) {
+    segments.back().length += bytes;
+  } else {
+    segments.push_back({totalSize, bytes, result, nullptr, std::string()});
+  }
+  totalSize += bytes;
+  return result;
+}
+
+void ChunkedBuffer::append(const void* source, size_t bytes) {
+  if (bytes > 0) {
+    memcpy(grow(bytes), source, bytes);
+  }
+}
+
+void ChunkedBuffer::align(size_t alignment) {
+  if ((totalSize % alignment) > 0) {
+    const size_t padding = alignment - (totalSize % alignment);
+    memset(grow(padding), 0, padding);
+  }
+}
+
+void ChunkedBuffer::defer(size_t bytes, Producer producer) {
+  if (bytes == 0) {
+    return;
+  }
+  segments.push_back({totalSize, bytes, nullptr, std::move(producer), std::string()});
+  totalSize += bytes;
+  largestDeferred = std::max(largestDeferred, bytes);
+}
+
+void ChunkedBuffer::appendFile(const std::string& path, size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  segments.push_back({totalSize, bytes, nullptr, nullptr, path});
+  totalSize += bytes;
+}
+
+void ChunkedBuffer::streamFile(
+    const Segment& segment,
+    const std::function<void(const uint8_t*, size_t)>& fn) const {
+  size_t done = 0;
+#if !defined(_WIN32)
+  // map the file and hand it over as-is, so the bytes go from page cache to output without a copy
+  const int fd = open(segment.file.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= segment.length) {
+      void* mapped = mmap(nullptr, segment.length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        madvise(mapped, segment.length, MADV_SEQUENTIAL);
+        fn(static_cast<const uint8_t*>(mapped), segment.length);
+        munmap(mapped, segment.length);
+        done = segment.length;
+      }
+    }
+    close(fd);
+  }
+#endif
+  if (done < segment.length) {
+    // no mmap; read it block by block instead
+    std::ifstream file(segment.file, std::ios::binary);
+    std::vector<char> block(std::min(segment.length, (size_t)(1 << 20)));
+    while (file && done < segment.length) {
+      file.read(block.data(), std::min(block.size(), segment.length - done));
+      const size_t count = (size_t)file.gcount();
+      if (count == 0) {
+        break;
+      }
+      fn(reinterpret_cast<const uint8_t*>(block.data()), count);
+      done += count;
+    }
+  }
+  if (done < segment.length) {
+    fmt::printf(
+        "Warning: only %lu of %lu bytes could be read from %s; padding with zeroes.\n",
+        done,
+        segment.length,
+        segment.file);
+    const std::vector<uint8_t> zeroes(segment.length - done, 0);
+    fn(zeroes.data(), zeroes.size());
+  }
+}
+
+bool ChunkedBuffer::equals(size_t offset, const void* source, size_t bytes) const {
+  if (offset + bytes > totalSize) {
+    return false;
+  }
+  // find the last segment that starts at or before the offset, then compare segment by segment
+  auto iter = std::upper_bound(
+      segments.begin(), segments.end(), offset, [](size_t offset, const Segment& segment) {
+        return offset < segment.offset;
+      });
+  const uint8_t* cursor = static_cast<const uint8_t*>(source);
+  for (--iter; bytes > 0; ++iter) {
+    const size_t start = offset - iter->offset;
+    const size_t length = std::min(bytes, iter->length - start);
+    if (iter->data == nullptr || memcmp(iter->data + start, cursor, length) != 0) {
+      return false;
+    }
+    cursor += length;
+    offset += length;
+    bytes -= length;
+  }
+  return true;
+}
+
+bool ChunkedBuffer::writeTo(FILE* fp) const {
+  bool success = true;
+  forEachRun([&](const uint8_t* data, size_t length) {
+    success = success && fwrite(data, length, 1, fp) == 1;
+  });
+  return success;
+}
+
+bool ChunkedBuffer::writeTo(std::ostream& out) const {
+  forEachRun([&](const uint8_t* data, size_t length) {
+    out.write(reinterpret_cast<const char*>(data), length);
+  });
+  return !out.fail();
+}
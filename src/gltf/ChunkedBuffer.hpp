@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The growing binary payload of a glTF buffer. Rather than one contiguous vector, which must be
+ * reallocated and copied wholesale as it grows, we write into a list of large arenas. Bytes, once
+ * written, never move. Each byte has a logical offset, exactly as if the buffer were a single
+ * vector; the buffer is a sequence of segments, each of which maps a range of logical offsets to
+ * contiguous memory.
+ *
+ * Segments may also be deferred: their length is laid out up front, but their bytes are produced
+ * only while the buffer is being written out, one segment at a time, into a scratch area. Writing
+ * the buffer then needs memory for the largest deferred segment, rather than for all of them.
+ * Segments can likewise be backed by a file, which is mapped (or read block by block) straight
+ * into the output at write time.
+ */
+class ChunkedBuffer {
+ public:
+  static const size_t DEFAULT_ARENA_SIZE = 16 * 1024 * 1024;
+
+  // fills in precisely the number of bytes it was deferred with
+  using Producer = std::function<void(uint8_t* destination)>;
+
+  explicit ChunkedBuffer(size_t arenaSize = DEFAULT_ARENA_SIZE);
+
+  size_t size() const {
+    return totalSize;
+  }
+  bool empty() const {
+    return totalSize == 0;
+  }
+
+  /**
+   * Extend the buffer by the given number of bytes, and return a pointer to them. They are
+   * contiguous in memory, and uninitialized: the caller must fill them all in.
+   */
+  uint8_t* grow(size_t bytes);
+
+  void append(const void* source, size_t bytes);
+
+  /** Pad with zeroes until the size is a multiple of the given alignment. */
+  void align(size_t alignment);
+
+  /**
+   * Make sure the next grow() or append() calls, up to this many bytes in total, are served from
+   * a single allocation. Use this ahead of a run of writes whose total size is known. Reserved
+   * memory is not touched until it is written to.
+   */
+  void reserve(size_t bytes);
+
+  /**
+   * Extend the buffer by the given number of bytes, without materializing them; the producer is
+   * called upon to fill them in when (and each time) the buffer is written out. Anything it
+   * refers to must outlive the buffer.
+   */
+  void defer(size_t bytes, Producer producer);
+
+  /**
+   * Extend the buffer by the given number of bytes, which are the (first) contents of the given
+   * file; it is only read when the buffer is written out. Should the file have shrunk by then, the
+   * missing bytes are written as zeroes.
+   */
+  void appendFile(const std::string& path, size_t bytes);
+
+  /**
+   * Whether the bytes at the given logical offset are identical to those at source. Deferred and
+   * file-backed segments never compare equal.
+   */
+  bool equals(size_t offset, const void* source, size_t bytes) const;
+
+  /**
+   * Call fn(const uint8_t* data, size_t length) for each contiguous run of bytes, in order. The
+   * data pointer is only valid for the duration of the call.
+   */
+  template <typename Fn>
+  void forEachRun(const Fn& fn) const {
+    std::unique_ptr<uint8_t[]> scratch;
+    for (const Segment& segment : segments) {
+      if (!segment.file.empty()) {
+        streamFile(segment, fn);
+      } else if (segment.producer) {
+        if (!scratch) {
+          scratch.reset(new uint8_t[largestDeferred]);
+        }
+        segment.producer(scratch.get());
+        fn(scratch.get(), segment.length);
+      } else {
+        fn(segment.data, segment.length);
+      }
+    }
+  }
+
+  bool writeTo(FILE* fp) const;
+  bool writeTo(std::ostream& out) const;
+
+ private:
+  struct Segment {
+    size_t offset; // the logical offset of the first byte
+    size_t length;
+    const uint8_t* data; // null for deferred and file-backed segments
+    Producer producer; // set for deferred segments
+    std::string file; // set for file-backed segments
+  };
+
+  void streamFile(const Segment& segment, const std::function<void(const uint8_t*, size_t)>& fn)
+      const;
+
+  const size_t arenaSize;
+  std::vector<std::unique_ptr<uint8_t[]>> arenas;
+  size_t arenaUsed;
+  size_t arenaCapacity;
+
+  std::vector<Segment> segments;
+  size_t totalSize;
+  size_t largestDeferred;
+};
@@ -8,32 +8,98 @@
 
 #include "GltfModel.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include <meshoptimizer.h>
+
+#include <utils/Hash_Utils.hpp>
+
 std::shared_ptr<BufferViewData> GltfModel::GetAlignedBufferView(
     BufferData& buffer,
     const BufferViewData::GL_ArrayType target) {
-  uint32_t bufferSize = to_uint32(this->binary->size());
-  if ((bufferSize % 4) > 0) {
-    bufferSize += (4 - (bufferSize % 4));
-    this->binary->resize(bufferSize);
-  }
+  ChunkedBuffer& data = BinaryOf(buffer);
+  data.align(4);
+  uint32_t bufferSize = to_uint32(data.size());
   return this->bufferViews.hold(new BufferViewData(buffer, bufferSize, target));
 }
 
+uint32_t GltfModel::ExtendBufferView(BufferViewData& bufferView) {
+  ChunkedBuffer& data = BinaryOf(bufferView);
+  if (bufferView.byteOffset + bufferView.byteLength != data.size()) {
+    // something else was written to the buffer since this view; its offsets would all be wrong
+    fmt::fprintf(
+        stderr,
+        "ERROR: Internal error: bufferView %u is no longer the last thing in its buffer.\n",
+        bufferView.ix);
+    std::abort();
+  }
+  data.align(4);
+  return to_uint32(data.size()) - bufferView.byteOffset;
+}
+
 // add a bufferview on the fly and copy data into it
 std::shared_ptr<BufferViewData>
 GltfModel::AddRawBufferView(BufferData& buffer, const char* source, uint32_t bytes) {
   auto bufferView = GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_NONE);
   bufferView->byteLength = bytes;
 
-  // make space for the new bytes (possibly moving the underlying data)
-  uint32_t bufferSize = to_uint32(this->binary->size());
-  this->binary->resize(bufferSize + bytes);
+  BinaryOf(buffer).append(source, bytes);
+  return bufferView;
+}
 
-  // and copy them into place
-  memcpy(&(*this->binary)[bufferSize], source, bytes);
+// like AddRawBufferView(), but reuse any earlier bufferview with precisely the same contents
+std::shared_ptr<BufferViewData>
+GltfModel::AddContentBufferView(BufferData& buffer, const char* source, uint32_t bytes) {
+  const auto key = std::make_pair(HashUtils::Hash64(source, bytes), bytes);
+  auto iter = contentToBufferView.find(key);
+  if (iter != contentToBufferView.end()) {
+    // a hash collision is improbable, but cheap enough to rule out
+    if (BinaryOf(buffer).equals(iter->second->byteOffset, source, bytes)) {
+      return iter->second;
+    }
+    return AddRawBufferView(buffer, source, bytes);
+  }
+  auto bufferView = AddRawBufferView(buffer, source, bytes);
+  contentToBufferView[key] = bufferView;
   return bufferView;
 }
 
+std::shared_ptr<AccessorData> GltfModel::GetZeroAccessor(const GLType& type, size_t count) {
+  const auto key = std::make_tuple((int)type.componentType.glType, type.dataType, count);
+  auto iter = zeroAccessors.find(key);
+  if (iter != zeroAccessors.end()) {
+    return iter->second;
+  }
+  auto accessor = accessors.hold(new AccessorData(type));
+  accessor->count = to_uint32(count);
+  accessor->min = std::vector<float>(type.count, 0.0f);
+  accessor->max = std::vector<float>(type.count, 0.0f);
+  zeroAccessors[key] = accessor;
+  return accessor;
+}
+
+std::shared_ptr<AccessorData> GltfModel::AddSamplerInputAccessor(
+    const std::function<BufferViewData&()>& getBufferView,
+    const std::vector<float>& times) {
+  const auto key =
+      std::make_pair(HashUtils::Hash64(times.data(), times.size() * sizeof(float)), times.size());
+  auto iter = samplerInputsByContent.find(key);
+  if (iter != samplerInputsByContent.end() && *iter->second.first == times) {
+    return iter->second.second;
+  }
+
+  auto accessor = AddDeferredAccessorWithView(getBufferView(), GLT_FLOAT, times, "");
+  accessor->min = {*std::min_element(times.begin(), times.end())};
+  accessor->max = {*std::max_element(times.begin(), times.end())};
+  if (iter == samplerInputsByContent.end()) {
+    samplerInputsByContent[key] = std::make_pair(&times, accessor);
+  }
+  return accessor;
+}
+
 std::shared_ptr<BufferViewData> GltfModel::AddBufferViewForFile(
     BufferData& buffer,
     const std::string& filename) {
@@ -49,9 +115,19 @@ std::shared_ptr<BufferViewData> GltfModel::AddBufferViewForFile(
     std::streamsize size = file.tellg();
     file.seekg(0, std::ios::beg);
 
+    if (isGlb) {
+      // don't read the file at all just yet: it's mapped straight into the .glb as it's written.
+      // Nor is it hashed here: TextureBuilder already shares one image between identical textures
+      result = GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_NONE);
+      result->byteLength = to_uint32(size);
+      BinaryOf(buffer).appendFile(filename, (size_t)size);
+      filenameToBufferView[filename] = result;
+      return result;
+    }
+
     std::vector<char> fileBuffer(size);
     if (file.read(fileBuffer.data(), size)) {
-      result = AddRawBufferView(buffer, fileBuffer.data(), to_uint32(size));
+      result = AddContentBufferView(buffer, fileBuffer.data(), to_uint32(size));
     } else {
       fmt::printf("Warning: Couldn't read %lu bytes from %s, skipping file.\n", size, filename);
     }
@@ -63,23 +139,192 @@ std::shared_ptr<BufferViewData> GltfModel::AddBufferViewForFile(
   return result;
 }
 
-void GltfModel::serializeHolders(json& glTFJson) {
-  serializeHolder(glTFJson, "buffers", buffers);
-  serializeHolder(glTFJson, "bufferViews", bufferViews);
-  serializeHolder(glTFJson, "scenes", scenes);
-  serializeHolder(glTFJson, "accessors", accessors);
-  serializeHolder(glTFJson, "images", images);
-  serializeHolder(glTFJson, "samplers", samplers);
-  serializeHolder(glTFJson, "textures", textures);
-  serializeHolder(glTFJson, "materials", materials);
-  serializeHolder(glTFJson, "meshes", meshes);
-  serializeHolder(glTFJson, "skins", skins);
-  serializeHolder(glTFJson, "animations", animations);
-  serializeHolder(glTFJson, "cameras", cameras);
-  serializeHolder(glTFJson, "nodes", nodes);
+void GltfModel::writeHolders(JsonWriter& writer) {
+  writeHolder(writer, "buffers", buffers);
+  writeHolder(writer, "bufferViews", bufferViews);
+  writeHolder(writer, "scenes", scenes);
+  writeHolder(writer, "accessors", accessors);
+  writeHolder(writer, "images", images);
+  writeHolder(writer, "samplers", samplers);
+  writeHolder(writer, "textures", textures);
+  writeHolder(writer, "materials", materials);
+  writeHolder(writer, "meshes", meshes);
+  writeHolder(writer, "skins", skins);
+  writeHolder(writer, "animations", animations);
+  writeHolder(writer, "cameras", cameras);
+  writeHolder(writer, "nodes", nodes);
   if (!lights.ptrs.empty()) {
-    json lightsJson = json::object();
-    serializeHolder(lightsJson, "lights", lights);
-    glTFJson["extensions"][KHR_LIGHTS_PUNCTUAL] = lightsJson;
+    writer.key("extensions").beginObject().key(KHR_LIGHTS_PUNCTUAL).beginObject();
+    writeHolder(writer, "lights", lights);
+    writer.endObject().endObject();
+  }
+}
+
+// turn a view's contents into what EXT_meshopt_compression's filter will turn back into them, if
+// the filter suits the contents' layout; returns false if it doesn't
+static bool applyMeshoptFilter(
+    BufferViewData::MeshoptFilter filter,
+    std::vector<uint8_t>& contents,
+    size_t count,
+    size_t stride) {
+  switch (filter) {
+    case BufferViewData::FILTER_NONE:
+      return true;
+    case BufferViewData::FILTER_OCTAHEDRAL:
+    case BufferViewData::FILTER_QUATERNION: {
+      // the contents are four normalized signed components per element, bytes or shorts
+      const size_t componentSize = stride / 4;
+      if ((stride != 4 && stride != 8) ||
+          (filter == BufferViewData::FILTER_QUATERNION && stride != 8)) {
+        return false;
+      }
+      std::vector<float> data(count * 4);
+      for (size_t ii = 0; ii < data.size(); ii++) {
+        if (componentSize == 1) {
+          data[ii] = std::max(static_cast<int8_t>(contents[ii]) / (float)INT8_MAX, -1.0f);
+        } else {
+          int16_t component;
+          memcpy(&component, &contents[ii * 2], 2);
+          data[ii] = std::max(component / (float)INT16_MAX, -1.0f);
+        }
+      }
+      if (filter == BufferViewData::FILTER_OCTAHEDRAL) {
+        meshopt_encodeFilterOct(contents.data(), count, stride, stride == 4 ? 8 : 16, data.data());
+      } else {
+        meshopt_encodeFilterQuat(contents.data(), count, stride, 16, data.data());
+      }
+      return true;
+    }
+    case BufferViewData::FILTER_EXPONENTIAL: {
+      // the contents are floats, with a 16-bit mantissa being plenty
+      std::vector<float> data(count * stride / 4);
+      memcpy(data.data(), contents.data(), data.size() * 4);
+      meshopt_encodeFilterExp(contents.data(), count, stride, 16, data.data());
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GltfModel::CompressMeshoptBufferViews() {
+  if (!meshoptFallbackBuffer) {
+    return false;
+  }
+  std::vector<BufferViewData*> views;
+  for (const auto& view : bufferViews.ptrs) {
+    if (view->buffer == meshoptFallbackBuffer->ix && view->byteLength > 0) {
+      views.push_back(view.get());
+    }
+  }
+  if (views.empty()) {
+    return false;
+  }
+  std::stable_sort(views.begin(), views.end(), [](BufferViewData* a, BufferViewData* b) {
+    return a->byteOffset < b->byteOffset;
+  });
+
+  // the element sizes of the accessors into each view: ideally, there's just the one
+  std::map<unsigned int, std::set<unsigned int>> elementSizes;
+  for (const auto& accessor : accessors.ptrs) {
+    if (accessor->bufferView >= 0) {
+      elementSizes[accessor->bufferView].insert(accessor->type.byteStride());
+    }
+    if (accessor->sparse.count > 0) {
+      elementSizes[accessor->sparse.bufferView].insert(accessor->type.byteStride());
+      elementSizes[accessor->sparse.bufferView].insert(
+          accessor->sparse.indicesComponentType == ComponentType::GL_UNSIGNED_SHORT ? 2 : 4);
+    }
+  }
+
+  auto encodeView = [&](BufferViewData& view, std::vector<uint8_t>& contents) {
+    const bool isIndices = view.target == BufferViewData::GL_ELEMENT_ARRAY_BUFFER;
+    // views that mix element sizes are encoded as a sequence of 4-byte words
+    size_t stride = 4;
+    const std::set<unsigned int>& sizes = elementSizes[view.ix];
+    if (sizes.size() == 1) {
+      const size_t size = *sizes.begin();
+      const bool supported = isIndices ? (size == 2 || size == 4) : (size % 4 == 0 && size <= 256);
+      if (supported && contents.size() % size == 0) {
+        stride = size;
+      }
+    }
+    // the padding is already there in the fallback buffer, which is 4-aligned throughout
+    contents.resize((contents.size() + stride - 1) / stride * stride, 0);
+    const size_t count = contents.size() / stride;
+
+    std::vector<uint8_t> encoded;
+    if (isIndices) {
+      assert(count % 3 == 0);
+      std::vector<unsigned int> indices(count);
+      for (size_t ii = 0; ii < count; ii++) {
+        if (stride == 2) {
+          uint16_t index;
+          memcpy(&index, &contents[ii * 2], 2);
+          indices[ii] = index;
+        } else {
+          memcpy(&indices[ii], &contents[ii * 4], 4);
+        }
+      }
+      const size_t vertexCount = *std::max_element(indices.begin(), indices.end()) + 1;
+      encoded.resize(meshopt_encodeIndexBufferBound(count, vertexCount));
+      encoded.resize(
+          meshopt_encodeIndexBuffer(encoded.data(), encoded.size(), indices.data(), count));
+    } else {
+      if (!applyMeshoptFilter(view.meshopt.filter, contents, count, stride)) {
+        view.meshopt.filter = BufferViewData::FILTER_NONE;
+      }
+      encoded.resize(meshopt_encodeVertexBufferBound(count, stride));
+      encoded.resize(meshopt_encodeVertexBuffer(
+          encoded.data(), encoded.size(), contents.data(), count, stride));
+    }
+
+    binary->align(4);
+    view.byteLength = to_uint32(contents.size());
+    view.meshopt.buffer = defaultBuffer->ix;
+    view.meshopt.byteOffset = to_uint32(binary->size());
+    view.meshopt.byteLength = to_uint32(encoded.size());
+    view.meshopt.byteStride = to_uint32(stride);
+    view.meshopt.count = to_uint32(count);
+    binary->append(encoded.data(), encoded.size());
+  };
+
+  // the fallback buffer is produced run by run, just as if it were being written out; each view's
+  // contents are gathered up, then encoded into the default buffer
+  meshoptBinary->align(4);
+  meshopt_encodeIndexVersion(1);
+  const size_t sizeBefore = binary->size();
+  size_t viewIx = 0;
+  size_t offset = 0;
+  std::vector<uint8_t> contents;
+  meshoptBinary->forEachRun([&](const uint8_t* run, size_t length) {
+    const size_t runStart = offset;
+    const size_t runEnd = runStart + length;
+    while (viewIx < views.size() && offset < runEnd) {
+      BufferViewData& view = *views[viewIx];
+      if (offset < view.byteOffset) {
+        offset = std::min(runEnd, (size_t)view.byteOffset);
+        continue;
+      }
+      const size_t viewEnd = view.byteOffset + view.byteLength;
+      const size_t end = std::min(runEnd, viewEnd);
+      contents.insert(contents.end(), run + (offset - runStart), run + (end - runStart));
+      offset = end;
+      if (offset == viewEnd) {
+        encodeView(view, contents);
+        contents.clear();
+        viewIx++;
+      }
+    }
+    offset = runEnd;
+  });
+  assert(viewIx == views.size());
+
+  if (verboseOutput) {
+    fmt::printf(
+        "EXT_meshopt_compression: %zu bufferViews, %zu bytes encoded into %zu.\n",
+        views.size(),
+        meshoptBinary->size(),
+        binary->size() - sizeBefore);
   }
+  return true;
 }
@@ -9,6 +9,9 @@
 #pragma once
 
 #include <fstream>
+#include <functional>
+#include <map>
+#include <tuple>
 
 #include "FBX2glTF.h"
 
@@ -53,22 +56,75 @@ class Holder {
 class GltfModel {
  public:
   explicit GltfModel(const GltfOptions& options)
-      : binary(new std::vector<uint8_t>),
+      : binary(new ChunkedBuffer()),
         isGlb(options.outputBinary),
         defaultSampler(nullptr),
         defaultBuffer(buffers.hold(buildDefaultBuffer(options))) {
     defaultSampler = samplers.hold(buildDefaultSampler());
+    if (options.useMeshopt) {
+      meshoptBinary.reset(new ChunkedBuffer());
+      meshoptFallbackBuffer = buffers.hold(new BufferData(meshoptBinary));
+      meshoptFallbackBuffer->isMeshoptFallback = true;
+    }
+  }
+
+  /** The binary data behind the given buffer: the fallback buffer has its own. */
+  ChunkedBuffer& BinaryOf(const BufferData& buffer) {
+    return buffer.isMeshoptFallback ? *meshoptBinary : *binary;
+  }
+  ChunkedBuffer& BinaryOf(const BufferViewData& bufferView) {
+    return BinaryOf(*buffers.ptrs[bufferView.buffer]);
   }
 
+  /**
+   * The buffer that geometry and animation data go into: with EXT_meshopt_compression, that's the
+   * fallback buffer, whose views are encoded into the default one by CompressMeshoptBufferViews().
+   */
+  BufferData& GetGeometryBuffer() {
+    return meshoptFallbackBuffer ? *meshoptFallbackBuffer : *defaultBuffer;
+  }
+
+  /**
+   * Encode every view of the EXT_meshopt_compression fallback buffer into the default buffer, as
+   * TRIANGLES for index views and ATTRIBUTES for all others. This produces all their data, so
+   * whatever it was deferred from must still be around. Returns false if there were none.
+   */
+  bool CompressMeshoptBufferViews();
+
   std::shared_ptr<BufferViewData> GetAlignedBufferView(
       BufferData& buffer,
       const BufferViewData::GL_ArrayType target);
   std::shared_ptr<BufferViewData>
   AddRawBufferView(BufferData& buffer, const char* source, uint32_t bytes);
+  std::shared_ptr<BufferViewData>
+  AddContentBufferView(BufferData& buffer, const char* source, uint32_t bytes);
   std::shared_ptr<BufferViewData> AddBufferViewForFile(
       BufferData& buffer,
       const std::string& filename);
 
+  /**
+   * Make room for one more accessor at the end of the given bufferView, which must be the latest
+   * addition to the binary, and return the byte offset at which that accessor begins within it.
+   * This is how several accessors come to share a bufferView, one after the other. Should anything
+   * else have been written to the binary since, the conversion is aborted.
+   */
+  uint32_t ExtendBufferView(BufferViewData& bufferView);
+
+  /**
+   * Give the bufferView the byteStride that elements of the given type need, if they're padded;
+   * see GLType::padding.
+   */
+  static void NoteByteStride(BufferViewData& bufferView, const GLType& type) {
+    if (type.padding > 0) {
+      bufferView.byteStride = type.byteStride();
+    }
+  }
+
+  /**
+   * Append an accessor to the given bufferView; see ExtendBufferView(). Vertex attribute views
+   * shared by several accessors need a byteStride, which we only write for padded elements, so
+   * those must not be shared.
+   */
   template <class T>
   std::shared_ptr<AccessorData> AddAccessorWithView(
       BufferViewData& bufferView,
@@ -76,11 +132,115 @@ class GltfModel {
       const std::vector<T>& source,
       std::string name) {
     auto accessor = accessors.hold(new AccessorData(bufferView, type, name));
-    accessor->appendAsBinaryArray(source, *binary);
-    bufferView.byteLength = accessor->byteLength();
+    NoteByteStride(bufferView, type);
+    accessor->byteOffset = ExtendBufferView(bufferView);
+    accessor->appendAsBinaryArray(source, BinaryOf(bufferView));
+    bufferView.byteLength = accessor->byteOffset + accessor->byteLength();
+    return accessor;
+  }
+
+  /**
+   * Like AddAccessorWithView(), except in glb mode, where the source is only read once the binary
+   * is written out, and so must outlive this model.
+   */
+  template <class T>
+  std::shared_ptr<AccessorData> AddDeferredAccessorWithView(
+      BufferViewData& bufferView,
+      const GLType& type,
+      const std::vector<T>& source,
+      std::string name) {
+    if (!isGlb) {
+      return AddAccessorWithView(bufferView, type, source, name);
+    }
+    auto accessor = accessors.hold(new AccessorData(bufferView, type, name));
+    NoteByteStride(bufferView, type);
+    accessor->byteOffset = ExtendBufferView(bufferView);
+    accessor->deferAsBinaryArray(source, BinaryOf(bufferView));
+    bufferView.byteLength = accessor->byteOffset + accessor->byteLength();
+    return accessor;
+  }
+
+  /**
+   * Like AddAccessorWithView(), except in glb mode, where the count elements are generated only
+   * once the binary is written out. Whatever generate() refers to must outlive this model.
+   */
+  template <class T>
+  std::shared_ptr<AccessorData> AddDeferredAccessorWithView(
+      BufferViewData& bufferView,
+      const GLType& type,
+      size_t count,
+      const std::function<std::vector<T>()>& generate,
+      std::string name) {
+    if (!isGlb) {
+      return AddAccessorWithView(bufferView, type, generate(), name);
+    }
+    auto accessor = accessors.hold(new AccessorData(bufferView, type, name));
+    NoteByteStride(bufferView, type);
+    accessor->byteOffset = ExtendBufferView(bufferView);
+    accessor->deferAsBinaryArray(count, generate, BinaryOf(bufferView));
+    bufferView.byteLength = accessor->byteOffset + accessor->byteLength();
+    return accessor;
+  }
+
+  /**
+   * An accessor of count all-zero elements, with (zero) bounds but no bufferView: glTF readers
+   * fill in the zeroes themselves. There's just one of these per type and count, shared by all.
+   */
+  std::shared_ptr<AccessorData> GetZeroAccessor(const GLType& type, size_t count);
+
+  /**
+   * Add an accessor of count elements that are all zero, except those at the given (strictly
+   * increasing) indices. Their values are produced by generate(), in the same order: in glb mode,
+   * only once the binary is written out. The indices and values go into a bufferView of their own.
+   * With no indices at all, this is simply GetZeroAccessor().
+   */
+  template <class T>
+  std::shared_ptr<AccessorData> AddSparseAccessor(
+      BufferData& buffer,
+      const GLType& type,
+      size_t count,
+      const std::vector<uint32_t>& indices,
+      const std::function<std::vector<T>()>& generate,
+      std::string name) {
+    if (indices.empty()) {
+      return GetZeroAccessor(type, count);
+    }
+    auto accessor = accessors.hold(new AccessorData(type));
+    accessor->count = to_uint32(count);
+    accessor->name = name;
+
+    auto bufferView = GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_NONE);
+    accessor->sparse.count = to_uint32(indices.size());
+    accessor->sparse.bufferView = bufferView->ix;
+
+    // sparse indices may be as short as the largest of them allows
+    AccessorData indexData(indices.back() <= UINT16_MAX ? GLT_USHORT : GLT_UINT);
+    accessor->sparse.indicesComponentType = indexData.type.componentType.glType;
+    accessor->sparse.indicesByteOffset = ExtendBufferView(*bufferView);
+    indexData.appendAsBinaryArray(indices, BinaryOf(*bufferView));
+    bufferView->byteLength = accessor->sparse.indicesByteOffset + indexData.byteLength();
+
+    AccessorData valueData(type);
+    accessor->sparse.valuesByteOffset = ExtendBufferView(*bufferView);
+    if (isGlb) {
+      valueData.deferAsBinaryArray(indices.size(), generate, BinaryOf(*bufferView));
+    } else {
+      valueData.appendAsBinaryArray(generate(), BinaryOf(*bufferView));
+    }
+    bufferView->byteLength = accessor->sparse.valuesByteOffset + valueData.byteLength();
     return accessor;
   }
 
+  /**
+   * Return an accessor for the given animation sampler input (keyframe times), reusing any earlier
+   * one with identical contents, from whichever animation. Only if there is none is getBufferView()
+   * called, and the times deferred into the view it returns, as with AddDeferredAccessorWithView();
+   * so the times must outlive the model.
+   */
+  std::shared_ptr<AccessorData> AddSamplerInputAccessor(
+      const std::function<BufferViewData&()>& getBufferView,
+      const std::vector<float>& times);
+
   template <class T>
   std::shared_ptr<AccessorData>
   AddAccessorAndView(BufferData& buffer, const GLType& type, const std::vector<T>& source) {
@@ -104,43 +264,96 @@ class GltfModel {
       const RawModel& surfaceModel,
       PrimitiveData& primitive,
       const AttributeDefinition<T>& attrDef) {
-    // copy attribute data into vector
-    std::vector<T> attribArr;
-    surfaceModel.GetAttributeArray<T>(attribArr, attrDef.rawAttributeIx);
-
     std::shared_ptr<AccessorData> accessor;
     if (attrDef.dracoComponentType != draco::DT_INVALID && primitive.dracoMesh != nullptr) {
+      // copy attribute data into vector
+      std::vector<T> attribArr;
+      surfaceModel.GetAttributeArray<T>(attribArr, attrDef.rawAttributeIx);
       primitive.AddDracoAttrib(attrDef, attribArr);
 
       accessor = accessors.hold(new AccessorData(attrDef.glType));
       accessor->count = to_uint32(attribArr.size());
     } else {
+      // the attribute array is cheap to recreate, so in glb mode, don't hang on to it
+      const RawModel* model = &surfaceModel;
+      const T RawVertex::*rawAttributeIx = attrDef.rawAttributeIx;
       auto bufferView = GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER);
-      accessor = AddAccessorWithView(*bufferView, attrDef.glType, attribArr, std::string(""));
+      accessor = AddDeferredAccessorWithView<T>(
+          *bufferView,
+          attrDef.glType,
+          surfaceModel.GetVertexCount(),
+          [model, rawAttributeIx]() {
+            std::vector<T> attribArr;
+            model->GetAttributeArray<T>(attribArr, rawAttributeIx);
+            return attribArr;
+          },
+          std::string(""));
     }
     primitive.AddAttrib(attrDef.gltfName, *accessor);
     return accessor;
   };
 
+  /**
+   * Like AddAttributeToPrimitive(), without Draco, but with each vertex's element made by
+   * convert(), e.g. to quantize it.
+   */
+  template <class T>
+  std::shared_ptr<AccessorData> AddConvertedAttributeToPrimitive(
+      BufferData& buffer,
+      const RawModel& surfaceModel,
+      PrimitiveData& primitive,
+      const std::string& gltfName,
+      const GLType& type,
+      const std::function<T(const RawVertex&)>& convert) {
+    const RawModel* model = &surfaceModel;
+    auto bufferView = GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER);
+    auto accessor = AddDeferredAccessorWithView<T>(
+        *bufferView,
+        type,
+        surfaceModel.GetVertexCount(),
+        [model, convert]() {
+          std::vector<T> result(model->GetVertexCount());
+          for (int ii = 0; ii < model->GetVertexCount(); ii++) {
+            result[ii] = convert(model->GetVertex(ii));
+          }
+          return result;
+        },
+        std::string(""));
+    primitive.AddAttrib(gltfName, *accessor);
+    return accessor;
+  }
+
   template <class T>
-  void serializeHolder(json& glTFJson, std::string key, const Holder<T> holder) {
+  void writeHolder(JsonWriter& writer, const std::string& key, const Holder<T>& holder) {
     if (!holder.ptrs.empty()) {
-      std::vector<json> bits;
+      writer.key(key).beginArray();
       for (const auto& ptr : holder.ptrs) {
-        bits.push_back(ptr->serialize());
+        ptr->write(writer);
       }
-      glTFJson[key] = bits;
+      writer.endArray();
     }
   }
 
-  void serializeHolders(json& glTFJson);
+  /** Write out all the glTF entities, as members of the (already begun) top-level object. */
+  void writeHolders(JsonWriter& writer);
 
   const bool isGlb;
 
   // cache BufferViewData instances that've already been created from a given filename
   std::map<std::string, std::shared_ptr<BufferViewData>> filenameToBufferView;
+  // ... and from a given (content hash, byte length), so identical files share a single view
+  std::map<std::pair<uint64_t, uint32_t>, std::shared_ptr<BufferViewData>> contentToBufferView;
+  // animation sampler inputs by (content hash, count), along with the times they were made from
+  std::map<
+      std::pair<uint64_t, size_t>,
+      std::pair<const std::vector<float>*, std::shared_ptr<AccessorData>>>
+      samplerInputsByContent;
+  // the shared all-zero accessors, by (component type, data type, count)
+  std::map<std::tuple<int, std::string, size_t>, std::shared_ptr<AccessorData>> zeroAccessors;
 
-  std::shared_ptr<std::vector<uint8_t>> binary;
+  std::shared_ptr<ChunkedBuffer> binary;
+  // with EXT_meshopt_compression, the uncompressed contents of the fallback buffer
+  std::shared_ptr<ChunkedBuffer> meshoptBinary;
 
   Holder<BufferData> buffers;
   Holder<BufferViewData> bufferViews;
@@ -159,6 +372,7 @@ class GltfModel {
 
   std::shared_ptr<SamplerData> defaultSampler;
   std::shared_ptr<BufferData> defaultBuffer;
+  std::shared_ptr<BufferData> meshoptFallbackBuffer;
 
  private:
   SamplerData* buildDefaultSampler() {
@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "JsonWriter.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+JsonWriter::JsonWriter(std::ostream& out, int indent)
+    : out(out),
+      pretty(indent >= 0),
+      indentStep(indent >= 0 ? static_cast<unsigned int>(indent) : 0),
+      afterKey(false) {
+  buffer.reserve(FLUSH_SIZE + 4096);
+}
+
+JsonWriter::~JsonWriter() {
+  flush();
+}
+
+void JsonWriter::flush() {
+  out.write(buffer.data(), buffer.size());
+  buffer.clear();
+}
+
+void JsonWriter::writeIndent() {
+  buffer.append(scopes.size() * indentStep, ' ');
+}
+
+// separate an array element or object member from whatever came before it in its scope
+void JsonWriter::nextElement() {
+  assert(!scopes.empty());
+  Scope& scope = scopes.back();
+  if (scope.count++ > 0) {
+    buffer += pretty ? ",\n" : ",";
+  } else if (pretty) {
+    buffer += '\n';
+  }
+  writeIndent();
+}
+
+void JsonWriter::beforeValue() {
+  if (afterKey) {
+    afterKey = false;
+  } else if (!scopes.empty()) {
+    assert(!scopes.back().isObject);
+    nextElement();
+  }
+}
+
+JsonWriter& JsonWriter::beginObject() {
+  beforeValue();
+  buffer += '{';
+  scopes.push_back({true, 0});
+  return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+  assert(!scopes.empty() && scopes.back().isObject && !afterKey);
+  const bool empty = scopes.back().count == 0;
+  scopes.pop_back();
+  if (!empty && pretty) {
+    buffer += '\n';
+    writeIndent();
+  }
+  buffer += '}';
+  maybeFlush();
+  return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+  beforeValue();
+  buffer += '[';
+  scopes.push_back({false, 0});
+  return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+  assert(!scopes.empty() && !scopes.back().isObject);
+  const bool empty = scopes.back().count == 0;
+  scopes.pop_back();
+  if (!empty && pretty) {
+    buffer += '\n';
+    writeIndent();
+  }
+  buffer += ']';
+  maybeFlush();
+  return *this;
+}
+
+JsonWriter& JsonWriter::key(const std::string& name) {
+  assert(!scopes.empty() && scopes.back().isObject && !afterKey);
+  nextElement();
+  buffer += '"';
+  writeEscaped(name);
+  buffer += pretty ? "\": " : "\":";
+  afterKey = true;
+  return *this;
+}
+
+void JsonWriter::writeEscaped(const std::string& s) {
+  static const char hexify[16] = {
+      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+  for (const char c : s) {
+    switch (c) {
+      case '"':
+        buffer += "\\\"";
+        break;
+      case '\\':
+        buffer += "\\\\";
+        break;
+      case '\b':
+        buffer += "\\b";
+        break;
+      case '\f':
+        buffer += "\\f";
+        break;
+      case '\n':
+        buffer += "\\n";
+        break;
+      case '\r':
+        buffer += "\\r";
+        break;
+      case '\t':
+        buffer += "\\t";
+        break;
+      default:
+        if (c >= 0x00 && c <= 0x1f) {
+          buffer += "\\u00";
+          buffer += hexify[c >> 4];
+          buffer += hexify[c & 0x0f];
+        } else {
+          buffer += c;
+        }
+        break;
+    }
+  }
+}
+
+JsonWriter& JsonWriter::value(const std::string& s) {
+  beforeValue();
+  buffer += '"';
+  writeEscaped(s);
+  buffer += '"';
+  maybeFlush();
+  return *this;
+}
+
+JsonWriter& JsonWriter::streamedValue(
+    const std::function<void(const StringSink& sink)>& produce) {
+  beforeValue();
+  buffer += '"';
+  produce([this](const char* chars, size_t length) {
+    buffer.append(chars, length);
+    maybeFlush();
+  });
+  buffer += '"';
+  maybeFlush();
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* s) {
+  return value(std::string(s));
+}
+
+JsonWriter& JsonWriter::value(bool b) {
+  beforeValue();
+  buffer += b ? "true" : "false";
+  return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+  beforeValue();
+  buffer += "null";
+  return *this;
+}
+
+JsonWriter& JsonWriter::signedValue(int64_t n) {
+  beforeValue();
+  if (n < 0) {
+    buffer += '-';
+    // negate in unsigned arithmetic, which is well-defined even for the most negative value
+    return unsignedDigits(0 - static_cast<uint64_t>(n));
+  }
+  return unsignedDigits(static_cast<uint64_t>(n));
+}
+
+JsonWriter& JsonWriter::unsignedValue(uint64_t n) {
+  beforeValue();
+  return unsignedDigits(n);
+}
+
+JsonWriter& JsonWriter::unsignedDigits(uint64_t n) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + n % 10);
+    n /= 10;
+  } while (n != 0);
+  while (count > 0) {
+    buffer += digits[--count];
+  }
+  return *this;
+}
+
+// mirrors the json library's own locale-independent float formatting, so output is unchanged
+JsonWriter& JsonWriter::value(double d) {
+  beforeValue();
+  if (d == 0) {
+    buffer += std::signbit(d) ? "-0.0" : "0.0";
+    return *this;
+  }
+
+  std::array<char, 64> digits{{}};
+  const int length = snprintf(
+      digits.data(), digits.size(), "%.*g", std::numeric_limits<double>::digits10, d);
+  assert(length > 0 && static_cast<size_t>(length) < digits.size());
+  char* end = digits.data() + length;
+
+  const auto loc = localeconv();
+  const char thousandsSep = (loc && loc->thousands_sep) ? loc->thousands_sep[0] : '\0';
+  const char decimalPoint = (loc && loc->decimal_point) ? loc->decimal_point[0] : '\0';
+  if (thousandsSep != '\0') {
+    end = std::remove(digits.data(), end, thousandsSep);
+  }
+  if (decimalPoint != '\0' && decimalPoint != '.') {
+    std::replace(digits.data(), end, decimalPoint, '.');
+  }
+
+  buffer.append(digits.data(), end);
+  if (std::none_of(digits.data(), end, [](char c) { return c == '.' || c == 'e' || c == 'E'; })) {
+    buffer += ".0";
+  }
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(const json& j) {
+  switch (j.type()) {
+    case json::value_t::object:
+      beginObject();
+      for (auto it = j.cbegin(); it != j.cend(); ++it) {
+        key(it.key());
+        value(it.value());
+      }
+      return endObject();
+    case json::value_t::array:
+      beginArray();
+      for (const auto& element : j) {
+        value(element);
+      }
+      return endArray();
+    case json::value_t::string:
+      return value(j.get<std::string>());
+    case json::value_t::boolean:
+      return value(j.get<bool>());
+    case json::value_t::number_integer:
+      return signedValue(j.get<int64_t>());
+    case json::value_t::number_unsigned:
+      return unsignedValue(j.get<uint64_t>());
+    case json::value_t::number_float:
+      return value(j.get<double>());
+    case json::value_t::discarded:
+      beforeValue();
+      buffer += "<discarded>";
+      return *this;
+    default:
+      return null();
+  }
+}
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "FBX2glTF.h"
+
+/**
+ * Writes JSON straight into a buffered output stream, as a sequence of begin/key/value/end calls,
+ * without ever building a DOM. The output is byte-for-byte what json::dump(indent) would produce
+ * for the equivalent document, whitespace and number formatting included.
+ *
+ * Values may be written where the document expects one: at the top level, as an array element,
+ * or right after key(). Objects write their members in the order in which they are given.
+ */
+class JsonWriter {
+ public:
+  // appends characters, verbatim, to a string value that is being streamed; see streamedValue()
+  using StringSink = std::function<void(const char* chars, size_t length)>;
+
+  /** As with json::dump(), a negative indent means no whitespace at all. */
+  JsonWriter(std::ostream& out, int indent);
+  ~JsonWriter();
+
+  JsonWriter& beginObject();
+  JsonWriter& endObject();
+  JsonWriter& beginArray();
+  JsonWriter& endArray();
+
+  JsonWriter& key(const std::string& name);
+
+  JsonWriter& value(const std::string& s);
+  JsonWriter& value(const char* s);
+  JsonWriter& value(bool b);
+  JsonWriter& value(double d);
+  JsonWriter& value(float f) {
+    return value(static_cast<double>(f));
+  }
+  JsonWriter& value(const json& j);
+  JsonWriter& null();
+
+  /**
+   * Write a string value whose contents are too large to hold in memory all at once, such as a
+   * data URI: the producer hands them to the sink piece by piece, and they go straight into the
+   * output. They are not escaped, so they must not contain quotes, backslashes or control codes.
+   */
+  JsonWriter& streamedValue(const std::function<void(const StringSink& sink)>& produce);
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, JsonWriter&>::type
+  value(T n) {
+    return signedValue(n);
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, JsonWriter&>::
+      type
+      value(T n) {
+    return unsignedValue(n);
+  }
+  template <typename T>
+  typename std::enable_if<std::is_enum<T>::value, JsonWriter&>::type value(T n) {
+    return signedValue(static_cast<int64_t>(n));
+  }
+
+  template <typename T>
+  JsonWriter& value(const std::vector<T>& values) {
+    beginArray();
+    for (const T& element : values) {
+      value(element);
+    }
+    return endArray();
+  }
+
+  template <typename T>
+  JsonWriter& value(const std::map<std::string, T>& members) {
+    beginObject();
+    for (const auto& entry : members) {
+      key(entry.first);
+      value(entry.second);
+    }
+    return endObject();
+  }
+
+  /** Shorthand for key(name) followed by value(v). */
+  template <typename T>
+  JsonWriter& member(const std::string& name, const T& v) {
+    key(name);
+    return value(v);
+  }
+
+  /** Hand everything written so far to the output stream. */
+  void flush();
+
+ private:
+  static const size_t FLUSH_SIZE = 64 * 1024;
+
+  struct Scope {
+    bool isObject;
+    size_t count;
+  };
+
+  JsonWriter& signedValue(int64_t n);
+  JsonWriter& unsignedValue(uint64_t n);
+  JsonWriter& unsignedDigits(uint64_t n);
+
+  void beforeValue();
+  void nextElement();
+  void writeIndent();
+  void writeEscaped(const std::string& s);
+  void maybeFlush() {
+    if (buffer.size() >= FLUSH_SIZE) {
+      flush();
+    }
+  }
+
+  std::ostream& out;
+  const bool pretty;
+  const unsigned int indentStep;
+
+  std::string buffer;
+  std::vector<Scope> scopes;
+  bool afterKey;
+};
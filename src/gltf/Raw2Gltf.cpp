@@ -8,10 +8,14 @@
 
 #include "Raw2Gltf.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
 
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -76,6 +80,420 @@ static const std::vector<TriangleIndex> getIndexArray(const RawModel& raw) {
   return result;
 }
 
+// an upper bound on a 4-aligned accessor's footprint in the binary buffer
+static size_t alignedBytes(size_t count, size_t stride) {
+  return count * stride + 3;
+}
+
+// whether a blend shape delta does anything to its vertex, as far as the glTF is concerned
+static bool movesVertex(const RawBlendVertex& blend, const GltfOptions& options) {
+  const Vec3f zero(0.0f);
+  return !(blend.position == zero) || (options.useBlendShapeNormals && !(blend.normal == zero)) ||
+      (options.useBlendShapeTangents && !(blend.tangent.xyz() == zero));
+}
+
+/**
+ * For each surface with blend shapes, the indices of the blend channels that move at least one of
+ * its vertices. The others are dropped from the surface's mesh altogether, along with their
+ * animated weights.
+ */
+static std::map<long, std::vector<int>> findLiveBlendChannels(
+    const std::vector<RawModel>& materialModels,
+    const GltfOptions& options) {
+  std::map<long, std::vector<bool>> isLive;
+  for (const RawModel& surfaceModel : materialModels) {
+    const RawSurface& rawSurface = surfaceModel.GetSurface(0);
+    std::vector<bool>& live = isLive[rawSurface.id];
+    live.resize(rawSurface.blendChannels.size(), false);
+    for (int vertexIx = 0; vertexIx < surfaceModel.GetVertexCount(); vertexIx++) {
+      const RawVertex& vertex = surfaceModel.GetVertex(vertexIx);
+      for (size_t channelIx = 0; channelIx < live.size(); channelIx++) {
+        if (!live[channelIx] && movesVertex(vertex.blends[channelIx], options)) {
+          live[channelIx] = true;
+        }
+      }
+    }
+  }
+
+  std::map<long, std::vector<int>> result;
+  for (const auto& entry : isLive) {
+    std::vector<int>& channels = result[entry.first];
+    for (size_t channelIx = 0; channelIx < entry.second.size(); channelIx++) {
+      if (entry.second[channelIx]) {
+        channels.push_back((int)channelIx);
+      }
+    }
+  }
+  return result;
+}
+
+// a rotation as four normalized signed shorts, the way glTF animation samplers allow them
+static Vec4s quantizeRotation(const Quatf& rotation) {
+  const float components[4] = {
+      rotation.vector()(0), rotation.vector()(1), rotation.vector()(2), rotation.scalar()};
+  Vec4s result(0, 0, 0, 0);
+  for (int ii = 0; ii < 4; ii++) {
+    const float clamped = std::max(-1.0f, std::min(1.0f, components[ii]));
+    result(ii) = static_cast<int16_t>(std::lround(clamped * INT16_MAX));
+  }
+  return result;
+}
+
+// the angle, in degrees, between a rotation and what's left of it once quantized
+static float rotationErrorDegrees(const Quatf& rotation, const Vec4s& quantized) {
+  const float components[4] = {
+      rotation.vector()(0), rotation.vector()(1), rotation.vector()(2), rotation.scalar()};
+  double dot = 0, originalLength = 0, restoredLength = 0;
+  for (int ii = 0; ii < 4; ii++) {
+    // this is how glTF readers map the integers back into [-1, 1]
+    const double restored = std::max(quantized(ii) / (double)INT16_MAX, -1.0);
+    dot += components[ii] * restored;
+    originalLength += components[ii] * components[ii];
+    restoredLength += restored * restored;
+  }
+  const double cosHalfAngle = std::min(1.0, fabs(dot) / sqrt(originalLength * restoredLength));
+  return (float)(2.0 * acos(cosHalfAngle) * 180.0 / M_PI);
+}
+
+/**
+ * Add the output accessor of an animated weights sampler. With --anim-quantize, weights that all
+ * lie within [0, 1] are stored as normalized unsigned integers: bytes if that loses nothing a
+ * short wouldn't, shorts otherwise. The largest error this introduces goes into maxError.
+ */
+static std::shared_ptr<AccessorData> addWeightsAccessor(
+    GltfModel& gltf,
+    BufferViewData& bufferView,
+    size_t count,
+    const std::function<std::vector<float>()>& generate,
+    const GltfOptions& options,
+    float& maxError) {
+  maxError = 0;
+  if (options.quantizeAnimations) {
+    const std::vector<float> weights = generate();
+    if (std::all_of(weights.begin(), weights.end(), [](float w) { return w >= 0 && w <= 1; })) {
+      auto quantizationError = [&weights](float scale) {
+        float result = 0;
+        for (const float w : weights) {
+          result = std::max(result, fabsf(std::round(w * scale) / scale - w));
+        }
+        return result;
+      };
+      const float byteError = quantizationError(UINT8_MAX);
+      const bool useBytes = byteError <= 0.5f / UINT16_MAX;
+      const float scale = useBytes ? UINT8_MAX : UINT16_MAX;
+      maxError = useBytes ? byteError : quantizationError(UINT16_MAX);
+
+      auto accessor = gltf.AddDeferredAccessorWithView<uint32_t>(
+          bufferView,
+          useBytes ? GLT_UBYTE : GLT_USHORT,
+          count,
+          [generate, scale]() {
+            std::vector<uint32_t> result;
+            for (const float w : generate()) {
+              result.push_back(static_cast<uint32_t>(std::lround(w * scale)));
+            }
+            return result;
+          },
+          "");
+      accessor->normalized = true;
+      return accessor;
+    }
+  }
+  return gltf.AddDeferredAccessorWithView<float>(
+      bufferView, {CT_FLOAT, 1, "SCALAR"}, count, generate, "");
+}
+
+/**
+ * With --mesh-quantize, each position p of a mesh is stored as shorts, round((p - offset) / scale),
+ * and each of its blend shape position deltas d as round(d / scale). The scale is the same along
+ * all three axes, so that the transform undoing it leaves normals alone.
+ */
+struct PositionQuantization {
+  Vec3f offset;
+  float scale;
+
+  Vec4s quantize(const Vec3f& position) const {
+    return quantizeDelta(position - offset);
+  }
+  Vec4s quantizeDelta(const Vec3f& delta) const {
+    Vec4s result(0, 0, 0, 0);
+    for (int ii = 0; ii < 3; ii++) {
+      const float value = delta(ii) / scale;
+      const float clamped = std::max(-(float)INT16_MAX, std::min((float)INT16_MAX, value));
+      result(ii) = static_cast<int16_t>(std::lround(clamped));
+    }
+    return result;
+  }
+  // what a mesh's node must apply to its quantized positions to put them back where they were
+  Mat4f dequantization() const {
+    return Mat4f::FromTranslationVector(offset) * Mat4f::FromScaleVector(Vec3f(scale));
+  }
+};
+
+/**
+ * For each surface, the quantization that spreads its positions, as well as the position deltas
+ * of its live blend channels, over the full range of a short.
+ */
+static std::map<long, PositionQuantization> findPositionQuantization(
+    const std::vector<RawModel>& materialModels,
+    const std::map<long, std::vector<int>>& liveBlendChannels) {
+  std::map<long, std::pair<Boundsf, float>> extents;
+  for (const RawModel& surfaceModel : materialModels) {
+    const long surfaceId = surfaceModel.GetSurface(0).id;
+    Boundsf& bounds = extents[surfaceId].first;
+    float& maxDelta = extents[surfaceId].second;
+    const std::vector<int>& live = liveBlendChannels.at(surfaceId);
+    for (int vertexIx = 0; vertexIx < surfaceModel.GetVertexCount(); vertexIx++) {
+      const RawVertex& vertex = surfaceModel.GetVertex(vertexIx);
+      bounds.AddPoint(vertex.position);
+      for (const int channelIx : live) {
+        const Vec3f& delta = vertex.blends[channelIx].position;
+        maxDelta =
+            std::max(maxDelta, std::max(fabsf(delta.x), std::max(fabsf(delta.y), fabsf(delta.z))));
+      }
+    }
+  }
+
+  std::map<long, PositionQuantization> result;
+  for (const auto& entry : extents) {
+    const Boundsf& bounds = entry.second.first;
+    const Vec3f halfSize = (bounds.max - bounds.min) * 0.5f;
+    const float extent =
+        std::max(entry.second.second, std::max(halfSize.x, std::max(halfSize.y, halfSize.z)));
+    PositionQuantization& quantization = result[entry.first];
+    quantization.offset = (bounds.min + bounds.max) * 0.5f;
+    quantization.scale = extent > 0 ? extent / INT16_MAX : 1.0f;
+  }
+  return result;
+}
+
+// a unit vector (or tangent, with its handedness) as normalized bytes
+static Vec4b quantizeUnitVector(const Vec4f& vector) {
+  Vec4b result(0, 0, 0, 0);
+  for (int ii = 0; ii < 4; ii++) {
+    const float clamped = std::max(-1.0f, std::min(1.0f, vector(ii)));
+    result(ii) = static_cast<int8_t>(std::lround(clamped * INT8_MAX));
+  }
+  return result;
+}
+
+// a UV within [0, 1] as normalized unsigned shorts
+static Vec2i quantizeTexCoords(const Vec2f& uv) {
+  Vec2i result(0, 0);
+  for (int ii = 0; ii < 2; ii++) {
+    const float clamped = std::max(0.0f, std::min(1.0f, uv(ii)));
+    result(ii) = static_cast<uint16_t>(std::lround(clamped * UINT16_MAX));
+  }
+  return result;
+}
+
+// a vertex attribute that a primitive can do without, and why
+struct PrunableAttribute {
+  int attribute;
+  const char* gltfName;
+  const char* reason;
+};
+
+/**
+ * The vertex attributes a primitive can do without, short of those the user explicitly asked to
+ * keep: vertex colors that are all opaque white, which glTF assumes of none at all; tangents with
+ * no normal map to use them; UVs with no textures to use them; and a second UV set that's all one
+ * value, since no material reads it.
+ */
+static std::vector<PrunableAttribute> findPrunableAttributes(
+    const RawModel& surfaceModel,
+    int keepAttribs) {
+  if (surfaceModel.GetTriangleCount() == 0 || surfaceModel.GetVertexCount() == 0) {
+    // nothing to go on, and nothing to gain
+    return {};
+  }
+  const int attributes = surfaceModel.GetVertexAttributes() &
+      ~(keepAttribs == -1 ? 0 : (keepAttribs & ~RAW_VERTEX_ATTRIBUTE_AUTO));
+  const RawMaterial& material = surfaceModel.GetMaterial(surfaceModel.GetTriangle(0).materialIndex);
+  const bool hasTextures = std::any_of(
+      std::begin(material.textures), std::end(material.textures), [](int ix) { return ix >= 0; });
+
+  bool allWhite = true;
+  bool constantUv1 = true;
+  const RawVertex& first = surfaceModel.GetVertex(0);
+  for (int ii = 0; ii < surfaceModel.GetVertexCount(); ii++) {
+    const RawVertex& vertex = surfaceModel.GetVertex(ii);
+    allWhite = allWhite && vertex.color == Vec4f(1.0f);
+    constantUv1 = constantUv1 && vertex.uv1 == first.uv1;
+  }
+
+  std::vector<PrunableAttribute> result;
+  if ((attributes & RAW_VERTEX_ATTRIBUTE_COLOR) != 0 && allWhite) {
+    result.push_back({RAW_VERTEX_ATTRIBUTE_COLOR, "COLOR_0", "all white"});
+  }
+  if ((attributes & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0 &&
+      material.textures[RAW_TEXTURE_USAGE_NORMAL] < 0) {
+    result.push_back({RAW_VERTEX_ATTRIBUTE_TANGENT, "TANGENT", "no normal map"});
+  }
+  if ((attributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0 && !hasTextures) {
+    result.push_back({RAW_VERTEX_ATTRIBUTE_UV0, "TEXCOORD_0", "no textures"});
+  }
+  if ((attributes & RAW_VERTEX_ATTRIBUTE_UV1) != 0 && constantUv1) {
+    result.push_back({RAW_VERTEX_ATTRIBUTE_UV1, "TEXCOORD_1", "all the same"});
+  }
+  return result;
+}
+
+// whether a primitive's second UV set is just a copy of its first
+static bool duplicatesFirstTexCoords(const RawModel& surfaceModel) {
+  for (int ii = 0; ii < surfaceModel.GetVertexCount(); ii++) {
+    const RawVertex& vertex = surfaceModel.GetVertex(ii);
+    if (!(vertex.uv1 == vertex.uv0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * A skinned vertex's joint weights as normalized unsigned integers, renormalized so that they still
+ * sum to exactly maxValue: whatever rounding leaves over goes to the largest weight.
+ */
+template <class T>
+static T quantizeJointWeights(const Vec4f& weights, int maxValue) {
+  float sum = 0;
+  for (int ii = 0; ii < 4; ii++) {
+    sum += std::max(0.0f, weights(ii));
+  }
+  T result(0, 0, 0, 0);
+  if (sum <= 0) {
+    return result;
+  }
+  int quantized[4];
+  int total = 0;
+  int largest = 0;
+  for (int ii = 0; ii < 4; ii++) {
+    quantized[ii] = static_cast<int>(std::lround(std::max(0.0f, weights(ii)) / sum * maxValue));
+    total += quantized[ii];
+    if (weights(ii) > weights(largest)) {
+      largest = ii;
+    }
+  }
+  quantized[largest] += maxValue - total;
+  for (int ii = 0; ii < 4; ii++) {
+    result(ii) = quantized[ii];
+  }
+  return result;
+}
+
+/**
+ * Add the accessor for one attribute of a blend shape target, whose elements convert() makes from
+ * the vertices' blend data for the given channel. If sparse, only the moved vertices are written;
+ * that type had better not be padded.
+ */
+template <class T>
+static std::shared_ptr<AccessorData> addTargetAccessor(
+    GltfModel& gltf,
+    BufferData& buffer,
+    const RawModel& surfaceModel,
+    int channelIx,
+    const std::shared_ptr<std::vector<uint32_t>>& moved,
+    bool sparse,
+    const GLType& type,
+    const std::function<T(const RawBlendVertex&)>& convert,
+    const std::string& name) {
+  // as with the other vertex attributes, regenerate the deltas when they're written out
+  const RawModel* model = &surfaceModel;
+  const int vertexCount = surfaceModel.GetVertexCount();
+  if (sparse) {
+    return gltf.AddSparseAccessor<T>(
+        buffer,
+        type,
+        vertexCount,
+        *moved,
+        [model, channelIx, convert, moved]() {
+          std::vector<T> result(moved->size());
+          for (size_t jj = 0; jj < moved->size(); jj++) {
+            result[jj] = convert(model->GetVertex((*moved)[jj]).blends[channelIx]);
+          }
+          return result;
+        },
+        name);
+  }
+  return gltf.AddDeferredAccessorWithView<T>(
+      *gltf.GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER),
+      type,
+      vertexCount,
+      [model, channelIx, convert]() {
+        std::vector<T> result(model->GetVertexCount());
+        for (int jj = 0; jj < model->GetVertexCount(); jj++) {
+          result[jj] = convert(model->GetVertex(jj).blends[channelIx]);
+        }
+        return result;
+      },
+      name);
+}
+
+/** Roughly how many bytes of binary data the animations will need, so we can reserve them. */
+static size_t estimateAnimationBytes(const RawModel& raw) {
+  size_t result = 0;
+  for (int i = 0; i < raw.GetAnimationCount(); i++) {
+    const RawAnimation& animation = raw.GetAnimation(i);
+    result += alignedBytes(animation.times.size(), sizeof(float));
+    for (const RawChannel& channel : animation.channels) {
+      result += alignedBytes(channel.translations.size(), sizeof(Vec3f));
+      result += alignedBytes(channel.rotations.size(), sizeof(Quatf));
+      result += alignedBytes(channel.scales.size(), sizeof(Vec3f));
+      result += alignedBytes(channel.weights.size(), sizeof(float));
+      result += alignedBytes(channel.weightTimes.size(), sizeof(float));
+    }
+  }
+  return result;
+}
+
+/** Roughly how many bytes of binary data the surfaces will need, so we can reserve them. */
+static size_t estimateGeometryBytes(
+    const std::vector<RawModel>& materialModels,
+    const GltfOptions& options) {
+  if (options.draco.enabled) {
+    // compressed sizes are anyone's guess
+    return 0;
+  }
+  size_t result = 0;
+  for (const RawModel& surfaceModel : materialModels) {
+    const size_t vertexCount = surfaceModel.GetVertexCount();
+    const int attributes = surfaceModel.GetVertexAttributes();
+
+    result += alignedBytes(3 * surfaceModel.GetTriangleCount(), sizeof(uint32_t));
+    size_t vertexStride = 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_POSITION) ? sizeof(Vec3f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_NORMAL) ? sizeof(Vec3f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_TANGENT) ? sizeof(Vec4f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_COLOR) ? sizeof(Vec4f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_UV0) ? sizeof(Vec2f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_UV1) ? sizeof(Vec2f) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) ? 4 * sizeof(uint16_t) : 0;
+    vertexStride += (attributes & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) ? sizeof(Vec4f) : 0;
+    result += alignedBytes(vertexCount, vertexStride) + 8 * 3;
+
+    for (const RawBlendChannel& channel : surfaceModel.GetSurface(0).blendChannels) {
+      size_t blendStride = sizeof(Vec3f);
+      blendStride += (options.useBlendShapeNormals && channel.hasNormals) ? sizeof(Vec3f) : 0;
+      blendStride += (options.useBlendShapeTangents && channel.hasTangents) ? sizeof(Vec3f) : 0;
+      result += alignedBytes(vertexCount, blendStride) + 2 * 3;
+    }
+  }
+  return result;
+}
+
+json Holdable::serialize() const {
+  std::ostringstream stream;
+  {
+    JsonWriter writer(stream, -1);
+    write(writer);
+  }
+  return json::parse(stream.str());
+}
+
+void Holdable::write(JsonWriter& writer) const {
+  writer.value(serialize());
+}
+
 ModelData* Raw2Gltf(
     std::ofstream& gltfOutStream,
     const std::string& outputFolder,
@@ -92,7 +510,7 @@ ModelData* Raw2Gltf(
     }
     if (raw.GetVertexCount() > 2 * raw.GetTriangleCount()) {
       fmt::printf(
-          "Warning: High vertex count. Make sure there are no unnecessary vertex attributes. (see -keepAttribute cmd-line option)");
+          "Warning: High vertex count. Make sure there are no unnecessary vertex attributes. (see -keepAttribute cmd-line option, and --weld for near-identical vertices)\n");
     }
   }
 
@@ -102,6 +520,32 @@ ModelData* Raw2Gltf(
       options.useLongIndices == UseLongIndicesOptions::NEVER,
       options.keepAttribs,
       true);
+  if (options.weld.enabled) {
+    raw.WeldMaterialModels(
+        materialModels, options.weld.position, options.weld.normalAngle, options.weld.uv);
+  }
+  // welding can leave a surface without any triangles, and so without a mesh
+  std::set<long> meshSurfaceIds;
+  for (const RawModel& surfaceModel : materialModels) {
+    meshSurfaceIds.insert(surfaceModel.GetSurface(0).id);
+  }
+  auto hasMesh = [&meshSurfaceIds](const RawNode& node) {
+    return node.surfaceId > 0 && meshSurfaceIds.count(node.surfaceId) > 0;
+  };
+  if (options.optimizeVertexCache || options.optimizeVertexFetch) {
+    raw.OptimizeMaterialModels(
+        materialModels, options.optimizeVertexCache, options.optimizeVertexFetch);
+  }
+  // with --lod, lodModels[level] holds simplified copies of materialModels
+  std::vector<std::vector<RawModel>> lodModels;
+  if (!options.lodRatios.empty()) {
+    raw.CreateLevelsOfDetail(materialModels, options.lodRatios, lodModels);
+    for (std::vector<RawModel>& levelModels : lodModels) {
+      if (options.optimizeVertexCache) {
+        raw.OptimizeMaterialModels(levelModels, true, false);
+      }
+    }
+  }
 
   if (verboseOutput) {
     fmt::printf("%7d vertices\n", raw.GetVertexCount());
@@ -114,6 +558,29 @@ ModelData* Raw2Gltf(
     fmt::printf("%7d lights\n", raw.GetLightCount());
   }
 
+  // blend shape targets that move none of a mesh's vertices are dropped from it
+  const std::map<long, std::vector<int>> liveBlendChannels =
+      findLiveBlendChannels(materialModels, options);
+  if (verboseOutput) {
+    for (int i = 0; i < raw.GetSurfaceCount(); i++) {
+      const RawSurface& rawSurface = raw.GetSurface(i);
+      auto iter = liveBlendChannels.find(rawSurface.id);
+      if (iter != liveBlendChannels.end() &&
+          iter->second.size() < rawSurface.blendChannels.size()) {
+        fmt::printf(
+            "Mesh '%s': dropped %lu of %lu blend shape targets, which move none of its vertices.\n",
+            rawSurface.name,
+            rawSurface.blendChannels.size() - iter->second.size(),
+            rawSurface.blendChannels.size());
+      }
+    }
+  }
+
+  std::map<long, PositionQuantization> positionQuantization;
+  if (options.quantizeMeshes) {
+    positionQuantization = findPositionQuantization(materialModels, liveBlendChannels);
+  }
+
   std::unique_ptr<GltfModel> gltf(new GltfModel(options));
 
   std::map<long, std::shared_ptr<NodeData>> nodesById;
@@ -124,6 +591,13 @@ ModelData* Raw2Gltf(
   // for now, we only have one buffer; data->binary points to the same vector as that BufferData
   // does.
   BufferData& buffer = *gltf->defaultBuffer;
+  // ... except with EXT_meshopt_compression, where geometry and animations go in a fallback buffer
+  BufferData& geometryBuffer = gltf->GetGeometryBuffer();
+  auto setMeshoptFilter = [&](const AccessorData& accessor, BufferViewData::MeshoptFilter filter) {
+    if (options.useMeshopt) {
+      gltf->bufferViews.ptrs[accessor.bufferView]->meshopt.filter = filter;
+    }
+  };
   {
     //
     // nodes
@@ -149,10 +623,75 @@ ModelData* Raw2Gltf(
       nodesById.insert(std::make_pair(node.id, nodeData));
     }
 
+    // with --mesh-quantize, the transform that dequantizes a mesh's positions goes on the node that
+    // holds it; so as not to move the node's children too, that's a child node of its own, except
+    // with skinning, which ignores that node's transform anyway (the inverse bind matrices get it).
+    // With --lod, every mesh gets such a node, which MSFT_lod swaps out without touching children.
+    std::map<long, std::shared_ptr<NodeData>> meshNodesById;
+    for (int i = 0; i < raw.GetNodeCount() && (options.quantizeMeshes || !lodModels.empty());
+         i++) {
+      const RawNode& node = raw.GetNode(i);
+      if (hasMesh(node)) {
+        const RawSurface& rawSurface = raw.GetSurface(raw.GetSurfaceById(node.surfaceId));
+        auto quantizationIter = positionQuantization.find(rawSurface.id);
+        const bool dequantize =
+            rawSurface.jointIds.empty() && quantizationIter != positionQuantization.end();
+        if (dequantize || !lodModels.empty()) {
+          Vec3f translation(0.0f);
+          Vec3f scale(1.0f);
+          if (dequantize) {
+            translation = quantizationIter->second.offset;
+            scale = Vec3f(quantizationIter->second.scale);
+          }
+          auto meshNode = gltf->nodes.hold(
+              new NodeData(node.name, translation, Quatf(1, 0, 0, 0), scale, false));
+          gltf->nodes.ptrs[i]->AddChildNode(meshNode->ix);
+          meshNodesById.insert(std::make_pair(node.id, meshNode));
+        }
+      }
+    }
+    // the node that holds the given node's mesh, and so has its blend shape weights animated
+    auto meshNodeOf = [&](const RawNode& node) -> NodeData& {
+      auto iter = meshNodesById.find(node.id);
+      return iter != meshNodesById.end() ? *iter->second : require(nodesById, node.id);
+    };
+
+    // each simplified level of a mesh goes on a node of its own, outside the scene hierarchy, that
+    // stands in for the mesh's node once the mesh covers less than half its ratio of the screen
+    std::map<long, std::vector<std::shared_ptr<NodeData>>> lodNodesById;
+    for (int i = 0; i < raw.GetNodeCount() && !lodModels.empty(); i++) {
+      const RawNode& node = raw.GetNode(i);
+      if (hasMesh(node)) {
+        NodeData& meshNode = meshNodeOf(node);
+        std::vector<std::shared_ptr<NodeData>>& lodNodes = lodNodesById[node.id];
+        std::vector<uint32_t> lodIxs;
+        std::vector<float> coverage;
+        for (size_t level = 0; level < lodModels.size(); level++) {
+          auto lodNode = gltf->nodes.hold(new NodeData(
+              fmt::format("{}_LOD{}", node.name, level + 1),
+              meshNode.translation,
+              meshNode.rotation,
+              meshNode.scale,
+              false));
+          lodNodes.push_back(lodNode);
+          lodIxs.push_back(lodNode->ix);
+          coverage.push_back(0.5f * options.lodRatios[level]);
+        }
+        // the least detailed level is never culled
+        coverage.push_back(0.0f);
+        meshNode.SetLevelsOfDetail(lodIxs, coverage);
+      }
+    }
+
     //
     // animations
     //
 
+    if (!options.outputBinary) {
+      // (in glb mode, this data is deferred until the binary is written out)
+      gltf->BinaryOf(geometryBuffer).reserve(estimateAnimationBytes(raw));
+    }
+
     for (int i = 0; i < raw.GetAnimationCount(); i++) {
       const RawAnimation& animation = raw.GetAnimation(i);
 
@@ -162,9 +701,20 @@ ModelData* Raw2Gltf(
         continue;
       }
 
-      auto accessor = gltf->AddAccessorAndView(buffer, GLT_FLOAT, animation.times);
-      accessor->min = {*std::min_element(std::begin(animation.times), std::end(animation.times))};
-      accessor->max = {*std::max_element(std::begin(animation.times), std::end(animation.times))};
+      // all of an animation's sampler data goes into one bufferView, rather than one per accessor;
+      // it lives on in the raw model, so the binary can refer to it directly. Since the keyframe
+      // times may already have been written for another animation, the view is only created once
+      // there's something to put in it. With EXT_meshopt_compression, each accessor gets a view of
+      // its own instead, so that the codec knows the stride of its elements and can filter them.
+      std::shared_ptr<BufferViewData> animationViewPtr;
+      auto animationView = [&]() -> BufferViewData& {
+        if (!animationViewPtr || options.useMeshopt) {
+          animationViewPtr =
+              gltf->GetAlignedBufferView(geometryBuffer, BufferViewData::GL_ARRAY_NONE);
+        }
+        return *animationViewPtr;
+      };
+      auto accessor = gltf->AddSamplerInputAccessor(animationView, animation.times);
 
       AnimationData& aDat = *gltf->animations.hold(new AnimationData(animation.name, *accessor));
       if (verboseOutput) {
@@ -191,24 +741,118 @@ ModelData* Raw2Gltf(
 
         NodeData& nDat = require(nodesById, node.id);
         if (!channel.translations.empty()) {
-          aDat.AddNodeChannel(
-              nDat,
-              *gltf->AddAccessorAndView(buffer, GLT_VEC3F, channel.translations),
-              "translation");
+          auto accessor = gltf->AddDeferredAccessorWithView(
+              animationView(), GLT_VEC3F, channel.translations, "");
+          setMeshoptFilter(*accessor, BufferViewData::FILTER_EXPONENTIAL);
+          aDat.AddNodeChannel(nDat, *accessor, "translation");
         }
+        // EXT_meshopt_compression's quaternion filter works on quantized rotations
+        const bool quantizeRotations = options.quantizeAnimations || options.useMeshopt;
+        float rotationError = 0;
         if (!channel.rotations.empty()) {
-          aDat.AddNodeChannel(
-              nDat, *gltf->AddAccessorAndView(buffer, GLT_QUATF, channel.rotations), "rotation");
+          if (quantizeRotations) {
+            for (const Quatf& rotation : channel.rotations) {
+              rotationError = std::max(
+                  rotationError, rotationErrorDegrees(rotation, quantizeRotation(rotation)));
+            }
+            const std::vector<Quatf>* rotations = &channel.rotations;
+            auto accessor = gltf->AddDeferredAccessorWithView<Vec4s>(
+                animationView(),
+                GLT_VEC4S,
+                rotations->size(),
+                [rotations]() {
+                  std::vector<Vec4s> result;
+                  result.reserve(rotations->size());
+                  for (const Quatf& rotation : *rotations) {
+                    result.push_back(quantizeRotation(rotation));
+                  }
+                  return result;
+                },
+                "");
+            accessor->normalized = true;
+            setMeshoptFilter(*accessor, BufferViewData::FILTER_QUATERNION);
+            aDat.AddNodeChannel(nDat, *accessor, "rotation");
+          } else {
+            aDat.AddNodeChannel(
+                nDat,
+                *gltf->AddDeferredAccessorWithView(
+                    animationView(), GLT_QUATF, channel.rotations, ""),
+                "rotation");
+          }
         }
         if (!channel.scales.empty()) {
-          aDat.AddNodeChannel(
-              nDat, *gltf->AddAccessorAndView(buffer, GLT_VEC3F, channel.scales), "scale");
+          auto accessor =
+              gltf->AddDeferredAccessorWithView(animationView(), GLT_VEC3F, channel.scales, "");
+          setMeshoptFilter(*accessor, BufferViewData::FILTER_EXPONENTIAL);
+          aDat.AddNodeChannel(nDat, *accessor, "scale");
         }
-        if (!channel.weights.empty()) {
-          aDat.AddNodeChannel(
-              nDat,
-              *gltf->AddAccessorAndView(buffer, {CT_FLOAT, 1, "SCALAR"}, channel.weights),
-              "weights");
+        float weightError = 0;
+        if (!channel.weights.empty() && (node.surfaceId <= 0 || hasMesh(node))) {
+          // the weights are laid out frame by frame, one for each of the mesh's blend channels
+          const std::vector<int>* live = nullptr;
+          size_t channelCount = 0;
+          if (node.surfaceId > 0) {
+            const RawSurface& rawSurface = raw.GetSurface(raw.GetSurfaceById(node.surfaceId));
+            auto liveIter = liveBlendChannels.find(node.surfaceId);
+            if (liveIter != liveBlendChannels.end()) {
+              live = &liveIter->second;
+              channelCount = rawSurface.blendChannels.size();
+            }
+          }
+          // weights that were thinned out on import have keyframe times of their own
+          const AccessorData& weightTimes = channel.weightTimes.empty()
+              ? *accessor
+              : *gltf->AddSamplerInputAccessor(animationView, channel.weightTimes);
+          const std::vector<float>* weights = &channel.weights;
+          std::shared_ptr<AccessorData> weightsAccessor;
+          if (live == nullptr || live->size() == channelCount) {
+            weightsAccessor = addWeightsAccessor(
+                *gltf,
+                animationView(),
+                weights->size(),
+                [weights]() { return *weights; },
+                options,
+                weightError);
+          } else if (!live->empty()) {
+            // some of the mesh's targets were dropped; so must their weights be
+            const std::vector<int> liveChannels = *live;
+            const size_t frameCount = weights->size() / channelCount;
+            weightsAccessor = addWeightsAccessor(
+                *gltf,
+                animationView(),
+                frameCount * live->size(),
+                [weights, liveChannels, channelCount, frameCount]() {
+                  std::vector<float> result;
+                  result.reserve(frameCount * liveChannels.size());
+                  for (size_t frameIx = 0; frameIx < frameCount; frameIx++) {
+                    for (const int channelIx : liveChannels) {
+                      result.push_back((*weights)[frameIx * channelCount + channelIx]);
+                    }
+                  }
+                  return result;
+                },
+                options,
+                weightError);
+          }
+          if (weightsAccessor) {
+            aDat.AddNodeChannel(meshNodeOf(node), weightTimes, *weightsAccessor, "weights");
+            // the simplified levels keep all of their mesh's targets, and animate the same way
+            auto lodIter = lodNodesById.find(node.id);
+            if (lodIter != lodNodesById.end()) {
+              for (const auto& lodNode : lodIter->second) {
+                aDat.AddNodeChannel(*lodNode, weightTimes, *weightsAccessor, "weights");
+              }
+            }
+          }
+        }
+
+        if (verboseOutput && quantizeRotations) {
+          if (!channel.rotations.empty()) {
+            fmt::printf("    Quantized rotations are off by at most %.4f degrees\n", rotationError);
+          }
+          if (!channel.weights.empty() && options.quantizeAnimations) {
+            fmt::printf("    Quantized weights are off by at most %.6f\n", weightError);
+          }
         }
       }
     }
@@ -409,7 +1053,34 @@ ModelData* Raw2Gltf(
       }
     }
 
-    for (const auto& surfaceModel : materialModels) {
+    // encode whatever images the materials left pending, in parallel
+    textureBuilder.finish();
+
+    if (!options.outputBinary) {
+      size_t geometryBytes = estimateGeometryBytes(materialModels, options);
+      for (const std::vector<RawModel>& levelModels : lodModels) {
+        geometryBytes += estimateGeometryBytes(levelModels, options);
+      }
+      gltf->BinaryOf(geometryBuffer).reserve(geometryBytes);
+    }
+
+    // the meshes of each simplified level of detail follow the full ones
+    std::vector<std::pair<size_t, const RawModel*>> levelSurfaceModels;
+    for (const RawModel& surfaceModel : materialModels) {
+      levelSurfaceModels.emplace_back(0, &surfaceModel);
+    }
+    for (size_t level = 0; level < lodModels.size(); level++) {
+      for (const RawModel& surfaceModel : lodModels[level]) {
+        levelSurfaceModels.emplace_back(level + 1, &surfaceModel);
+      }
+    }
+    std::vector<std::map<long, std::shared_ptr<MeshData>>> lodMeshesBySurfaceId(lodModels.size());
+
+    // targets (or their normals or tangents) that move nothing in a primitive
+    size_t inertTargetCount = 0;
+    for (const auto& levelSurfaceModel : levelSurfaceModels) {
+      const size_t level = levelSurfaceModel.first;
+      const RawModel& surfaceModel = *levelSurfaceModel.second;
       assert(surfaceModel.GetSurfaceCount() == 1);
       const RawSurface& rawSurface = surfaceModel.GetSurface(0);
       const long surfaceId = rawSurface.id;
@@ -418,18 +1089,22 @@ ModelData* Raw2Gltf(
           surfaceModel.GetMaterial(surfaceModel.GetTriangle(0).materialIndex);
       const MaterialData& mData = require(materialsById, rawMaterial.id);
 
+      std::map<long, std::shared_ptr<MeshData>>& levelMeshesBySurfaceId =
+          level == 0 ? meshBySurfaceId : lodMeshesBySurfaceId[level - 1];
       MeshData* mesh = nullptr;
-      auto meshIter = meshBySurfaceId.find(surfaceId);
-      if (meshIter != meshBySurfaceId.end()) {
+      auto meshIter = levelMeshesBySurfaceId.find(surfaceId);
+      if (meshIter != levelMeshesBySurfaceId.end()) {
         mesh = meshIter->second.get();
 
       } else {
         std::vector<float> defaultDeforms;
-        for (const auto& channel : rawSurface.blendChannels) {
-          defaultDeforms.push_back(channel.defaultDeform);
+        for (const int channelIx : liveBlendChannels.at(surfaceId)) {
+          defaultDeforms.push_back(rawSurface.blendChannels[channelIx].defaultDeform);
         }
-        auto meshPtr = gltf->meshes.hold(new MeshData(rawSurface.name, defaultDeforms));
-        meshBySurfaceId[surfaceId] = meshPtr;
+        const std::string meshName =
+            level == 0 ? rawSurface.name : fmt::format("{}_LOD{}", rawSurface.name, level);
+        auto meshPtr = gltf->meshes.hold(new MeshData(meshName, defaultDeforms));
+        levelMeshesBySurfaceId[surfaceId] = meshPtr;
         mesh = meshPtr.get();
       }
 
@@ -459,10 +1134,11 @@ ModelData* Raw2Gltf(
         indexes.count = to_uint32(3 * triangleCount);
         primitive.reset(new PrimitiveData(indexes, mData, dracoMesh));
       } else {
-        const AccessorData& indexes = *gltf->AddAccessorWithView(
-            *gltf->GetAlignedBufferView(buffer, BufferViewData::GL_ELEMENT_ARRAY_BUFFER),
+        const AccessorData& indexes = *gltf->AddDeferredAccessorWithView<TriangleIndex>(
+            *gltf->GetAlignedBufferView(geometryBuffer, BufferViewData::GL_ELEMENT_ARRAY_BUFFER),
             useLongIndices ? GLT_UINT : GLT_USHORT,
-            getIndexArray(surfaceModel),
+            3 * surfaceModel.GetTriangleCount(),
+            [&surfaceModel]() { return getIndexArray(surfaceModel); },
             std::string(""));
         primitive.reset(new PrimitiveData(indexes, mData));
       };
@@ -471,45 +1147,141 @@ ModelData* Raw2Gltf(
       // surface vertices
       //
       {
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_POSITION) != 0) {
+        // attributes that the primitive doesn't need are dropped, unless --no-prune-attributes
+        int vertexAttributes = surfaceModel.GetVertexAttributes();
+        if (options.pruneAttributes) {
+          const std::vector<PrunableAttribute> pruned =
+              findPrunableAttributes(surfaceModel, options.keepAttribs);
+          for (const PrunableAttribute& attribute : pruned) {
+            vertexAttributes &= ~attribute.attribute;
+          }
+          if (verboseOutput && !pruned.empty()) {
+            fmt::printf(
+                "Mesh '%s', primitive %lu drops:",
+                rawSurface.name.c_str(),
+                mesh->primitives.size());
+            for (const PrunableAttribute& attribute : pruned) {
+              fmt::printf(" %s (%s)", attribute.gltfName, attribute.reason);
+            }
+            fmt::printf("\n");
+          }
+        }
+        // ... and a second UV set that copies the first shares its accessor
+        const bool shareTexCoords = options.pruneAttributes && !options.draco.enabled &&
+            (vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0 &&
+            (vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV1) != 0 &&
+            duplicatesFirstTexCoords(surfaceModel);
+        if (shareTexCoords) {
+          vertexAttributes &= ~RAW_VERTEX_ATTRIBUTE_UV1;
+          if (verboseOutput) {
+            fmt::printf(
+                "Mesh '%s', primitive %lu shares TEXCOORD_0 as TEXCOORD_1\n",
+                rawSurface.name.c_str(),
+                mesh->primitives.size());
+          }
+        }
+
+        // with --mesh-quantize, UVs become normalized unsigned shorts, if they stay within [0, 1]
+        auto addQuantizedTexCoords = [&](const std::string& name, Vec2f RawVertex::*uv) -> bool {
+          if (!options.quantizeMeshes) {
+            return false;
+          }
+          for (int jj = 0; jj < surfaceModel.GetVertexCount(); jj++) {
+            const Vec2f& value = surfaceModel.GetVertex(jj).*uv;
+            if (value.x < 0 || value.x > 1 || value.y < 0 || value.y > 1) {
+              return false;
+            }
+          }
+          auto accessor = gltf->AddConvertedAttributeToPrimitive<Vec2i>(
+              geometryBuffer,
+              surfaceModel,
+              *primitive,
+              name,
+              GLT_VEC2I,
+              [uv](const RawVertex& vertex) { return quantizeTexCoords(vertex.*uv); });
+          accessor->normalized = true;
+          return true;
+        };
+
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_POSITION) != 0 &&
+            options.quantizeMeshes) {
+          const PositionQuantization quantization = positionQuantization.at(surfaceId);
+          auto accessor = gltf->AddConvertedAttributeToPrimitive<Vec4s>(
+              geometryBuffer,
+              surfaceModel,
+              *primitive,
+              "POSITION",
+              GLT_VEC3S_PADDED,
+              [quantization](const RawVertex& vertex) {
+                return quantization.quantize(vertex.position);
+              });
+
+          const Vec4s min = quantization.quantize(rawSurface.bounds.min);
+          const Vec4s max = quantization.quantize(rawSurface.bounds.max);
+          accessor->min = {(float)min.x, (float)min.y, (float)min.z};
+          accessor->max = {(float)max.x, (float)max.y, (float)max.z};
+        } else if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_POSITION) != 0) {
           const AttributeDefinition<Vec3f> ATTR_POSITION(
               "POSITION",
               &RawVertex::position,
               GLT_VEC3F,
               draco::GeometryAttribute::POSITION,
               draco::DT_FLOAT32);
-          auto accessor =
-              gltf->AddAttributeToPrimitive<Vec3f>(buffer, surfaceModel, *primitive, ATTR_POSITION);
+          auto accessor = gltf->AddAttributeToPrimitive<Vec3f>(
+              geometryBuffer, surfaceModel, *primitive, ATTR_POSITION);
 
           accessor->min = toStdVec(rawSurface.bounds.min);
           accessor->max = toStdVec(rawSurface.bounds.max);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_NORMAL) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_NORMAL) != 0 &&
+            options.quantizeMeshes) {
+          auto accessor = gltf->AddConvertedAttributeToPrimitive<Vec4b>(
+              geometryBuffer,
+              surfaceModel,
+              *primitive,
+              "NORMAL",
+              GLT_VEC3B_PADDED,
+              [](const RawVertex& vertex) { return quantizeUnitVector(Vec4f(vertex.normal, 0)); });
+          accessor->normalized = true;
+          setMeshoptFilter(*accessor, BufferViewData::FILTER_OCTAHEDRAL);
+        } else if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_NORMAL) != 0) {
           const AttributeDefinition<Vec3f> ATTR_NORMAL(
               "NORMAL",
               &RawVertex::normal,
               GLT_VEC3F,
               draco::GeometryAttribute::NORMAL,
               draco::DT_FLOAT32);
-          const auto _ =
-              gltf->AddAttributeToPrimitive<Vec3f>(buffer, surfaceModel, *primitive, ATTR_NORMAL);
+          const auto _ = gltf->AddAttributeToPrimitive<Vec3f>(
+              geometryBuffer, surfaceModel, *primitive, ATTR_NORMAL);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0 &&
+            options.quantizeMeshes) {
+          auto accessor = gltf->AddConvertedAttributeToPrimitive<Vec4b>(
+              geometryBuffer,
+              surfaceModel,
+              *primitive,
+              "TANGENT",
+              GLT_VEC4B,
+              [](const RawVertex& vertex) { return quantizeUnitVector(vertex.tangent); });
+          accessor->normalized = true;
+          setMeshoptFilter(*accessor, BufferViewData::FILTER_OCTAHEDRAL);
+        } else if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0) {
           const AttributeDefinition<Vec4f> ATTR_TANGENT("TANGENT", &RawVertex::tangent, GLT_VEC4F);
           const auto _ = gltf->AddAttributeToPrimitive<Vec4f>(
-              buffer, surfaceModel, *primitive, ATTR_TANGENT);
+              geometryBuffer, surfaceModel, *primitive, ATTR_TANGENT);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_COLOR) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_COLOR) != 0) {
           const AttributeDefinition<Vec4f> ATTR_COLOR(
               "COLOR_0",
               &RawVertex::color,
               GLT_VEC4F,
               draco::GeometryAttribute::COLOR,
               draco::DT_FLOAT32);
-          const auto _ =
-              gltf->AddAttributeToPrimitive<Vec4f>(buffer, surfaceModel, *primitive, ATTR_COLOR);
+          const auto _ = gltf->AddAttributeToPrimitive<Vec4f>(
+              geometryBuffer, surfaceModel, *primitive, ATTR_COLOR);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_UV0) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0 &&
+            !addQuantizedTexCoords("TEXCOORD_0", &RawVertex::uv0)) {
           const AttributeDefinition<Vec2f> ATTR_TEXCOORD_0(
               "TEXCOORD_0",
               &RawVertex::uv0,
@@ -517,9 +1289,10 @@ ModelData* Raw2Gltf(
               draco::GeometryAttribute::TEX_COORD,
               draco::DT_FLOAT32);
           const auto _ = gltf->AddAttributeToPrimitive<Vec2f>(
-              buffer, surfaceModel, *primitive, ATTR_TEXCOORD_0);
+              geometryBuffer, surfaceModel, *primitive, ATTR_TEXCOORD_0);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_UV1) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV1) != 0 &&
+            !addQuantizedTexCoords("TEXCOORD_1", &RawVertex::uv1)) {
           const AttributeDefinition<Vec2f> ATTR_TEXCOORD_1(
               "TEXCOORD_1",
               &RawVertex::uv1,
@@ -527,73 +1300,176 @@ ModelData* Raw2Gltf(
               draco::GeometryAttribute::TEX_COORD,
               draco::DT_FLOAT32);
           const auto _ = gltf->AddAttributeToPrimitive<Vec2f>(
-              buffer, surfaceModel, *primitive, ATTR_TEXCOORD_1);
+              geometryBuffer, surfaceModel, *primitive, ATTR_TEXCOORD_1);
+        }
+        if (shareTexCoords) {
+          const int uv0Accessor = primitive->attributes.at("TEXCOORD_0");
+          primitive->AddAttrib("TEXCOORD_1", *gltf->accessors.ptrs[uv0Accessor]);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) != 0) {
+        // without Draco, joint indices are bytes when the skin has few enough joints for that,
+        // and joint weights normalized integers unless --skin-weights says otherwise
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) != 0 &&
+            !options.draco.enabled && rawSurface.jointIds.size() <= UINT8_MAX + 1) {
+          const auto _ = gltf->AddConvertedAttributeToPrimitive<Vec4ub>(
+              geometryBuffer,
+              surfaceModel,
+              *primitive,
+              "JOINTS_0",
+              GLT_VEC4UB,
+              [](const RawVertex& vertex) {
+                const Vec4i& joints = vertex.jointIndices;
+                return Vec4ub(joints.x, joints.y, joints.z, joints.w);
+              });
+        } else if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) != 0) {
           const AttributeDefinition<Vec4i> ATTR_JOINTS(
               "JOINTS_0",
               &RawVertex::jointIndices,
               GLT_VEC4I,
               draco::GeometryAttribute::GENERIC,
               draco::DT_UINT16);
-          const auto _ =
-              gltf->AddAttributeToPrimitive<Vec4i>(buffer, surfaceModel, *primitive, ATTR_JOINTS);
+          const auto _ = gltf->AddAttributeToPrimitive<Vec4i>(
+              geometryBuffer, surfaceModel, *primitive, ATTR_JOINTS);
         }
-        if ((surfaceModel.GetVertexAttributes() & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) != 0) {
+        if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) != 0 &&
+            !options.draco.enabled && options.skinWeights != SkinWeightsOptions::FLOAT) {
+          std::shared_ptr<AccessorData> accessor;
+          if (options.skinWeights == SkinWeightsOptions::UBYTE) {
+            accessor = gltf->AddConvertedAttributeToPrimitive<Vec4ub>(
+                geometryBuffer,
+                surfaceModel,
+                *primitive,
+                "WEIGHTS_0",
+                GLT_VEC4UB,
+                [](const RawVertex& vertex) {
+                  return quantizeJointWeights<Vec4ub>(vertex.jointWeights, UINT8_MAX);
+                });
+          } else {
+            accessor = gltf->AddConvertedAttributeToPrimitive<Vec4i>(
+                geometryBuffer,
+                surfaceModel,
+                *primitive,
+                "WEIGHTS_0",
+                GLT_VEC4I,
+                [](const RawVertex& vertex) {
+                  return quantizeJointWeights<Vec4i>(vertex.jointWeights, UINT16_MAX);
+                });
+          }
+          accessor->normalized = true;
+        } else if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) != 0) {
           const AttributeDefinition<Vec4f> ATTR_WEIGHTS(
               "WEIGHTS_0",
               &RawVertex::jointWeights,
               GLT_VEC4F,
               draco::GeometryAttribute::GENERIC,
               draco::DT_FLOAT32);
-          const auto _ =
-              gltf->AddAttributeToPrimitive<Vec4f>(buffer, surfaceModel, *primitive, ATTR_WEIGHTS);
+          const auto _ = gltf->AddAttributeToPrimitive<Vec4f>(
+              geometryBuffer, surfaceModel, *primitive, ATTR_WEIGHTS);
         }
 
-        // each channel present in the mesh always ends up a target in the primitive
-        for (int channelIx = 0; channelIx < rawSurface.blendChannels.size(); channelIx++) {
+        // each channel that's live anywhere in the mesh ends up a target in every primitive, since
+        // they must all have the same targets; where it moves none of a primitive's vertices, it
+        // shares the one all-zero accessor
+        for (const int channelIx : liveBlendChannels.at(surfaceId)) {
           const auto& channel = rawSurface.blendChannels[channelIx];
 
           // track the bounds of each shape channel
           Bounds<float, 3> shapeBounds;
-
-          std::vector<Vec3f> positions, normals;
-          std::vector<Vec4f> tangents;
           for (int jj = 0; jj < surfaceModel.GetVertexCount(); jj++) {
-            auto blendVertex = surfaceModel.GetVertex(jj).blends[channelIx];
-            shapeBounds.AddPoint(blendVertex.position);
-            positions.push_back(blendVertex.position);
-            if (options.useBlendShapeTangents && channel.hasNormals) {
-              normals.push_back(blendVertex.normal);
+            shapeBounds.AddPoint(surfaceModel.GetVertex(jj).blends[channelIx].position);
+          }
+          const bool hasNormals = options.useBlendShapeNormals && channel.hasNormals;
+          const bool hasTangents = options.useBlendShapeTangents && channel.hasTangents &&
+              (vertexAttributes & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0;
+
+          // deltas that leave most vertices alone are written sparsely, as just the ones they
+          // move; with --mesh-quantize, position deltas are shorts, like the positions, and normal
+          // and tangent deltas normalized bytes, as long as they stay within [-1, 1]
+          const int vertexCount = surfaceModel.GetVertexCount();
+          using DeltaFunction = std::function<Vec3f(const RawBlendVertex&)>;
+          auto addDeltas = [&](const DeltaFunction& delta,
+                               bool isPosition) -> std::shared_ptr<AccessorData> {
+            auto moved = std::make_shared<std::vector<uint32_t>>();
+            float maxComponent = 0;
+            for (int jj = 0; jj < vertexCount; jj++) {
+              const Vec3f d = delta(surfaceModel.GetVertex(jj).blends[channelIx]);
+              if (d.x != 0.0f || d.y != 0.0f || d.z != 0.0f) {
+                moved->push_back(jj);
+                maxComponent =
+                    std::max(maxComponent, std::max(fabsf(d.x), std::max(fabsf(d.y), fabsf(d.z))));
+              }
+            }
+            if (moved->empty()) {
+              inertTargetCount++;
+              return gltf->GetZeroAccessor(GLT_VEC3F, vertexCount);
             }
-            if (options.useBlendShapeTangents && channel.hasTangents) {
-              tangents.push_back(blendVertex.tangent);
+            const bool sparse = moved->size() < options.blendShapeSparseThreshold * vertexCount;
+            if (options.quantizeMeshes && isPosition) {
+              const PositionQuantization quantization = positionQuantization.at(surfaceId);
+              return addTargetAccessor<Vec4s>(
+                  *gltf,
+                  geometryBuffer,
+                  surfaceModel,
+                  channelIx,
+                  moved,
+                  sparse,
+                  sparse ? GLT_VEC3S : GLT_VEC3S_PADDED,
+                  [delta, quantization](const RawBlendVertex& blend) {
+                    return quantization.quantizeDelta(delta(blend));
+                  },
+                  channel.name);
             }
+            if (options.quantizeMeshes && maxComponent <= 1) {
+              auto accessor = addTargetAccessor<Vec4b>(
+                  *gltf,
+                  geometryBuffer,
+                  surfaceModel,
+                  channelIx,
+                  moved,
+                  sparse,
+                  sparse ? GLT_VEC3B : GLT_VEC3B_PADDED,
+                  [delta](const RawBlendVertex& blend) {
+                    return quantizeUnitVector(Vec4f(delta(blend), 0));
+                  },
+                  channel.name);
+              accessor->normalized = true;
+              return accessor;
+            }
+            return addTargetAccessor<Vec3f>(
+                *gltf,
+                geometryBuffer,
+                surfaceModel,
+                channelIx,
+                moved,
+                sparse,
+                GLT_VEC3F,
+                delta,
+                channel.name);
+          };
+
+          std::shared_ptr<AccessorData> pAcc =
+              addDeltas([](const RawBlendVertex& blend) { return blend.position; }, true);
+          if (pAcc->min.empty() && options.quantizeMeshes) {
+            const PositionQuantization& quantization = positionQuantization.at(surfaceId);
+            const Vec4s min = quantization.quantizeDelta(shapeBounds.min);
+            const Vec4s max = quantization.quantizeDelta(shapeBounds.max);
+            pAcc->min = {(float)min.x, (float)min.y, (float)min.z};
+            pAcc->max = {(float)max.x, (float)max.y, (float)max.z};
+          } else if (pAcc->min.empty()) {
+            // (the shared zero accessor comes with bounds of its own)
+            pAcc->min = toStdVec(shapeBounds.min);
+            pAcc->max = toStdVec(shapeBounds.max);
           }
-          std::shared_ptr<AccessorData> pAcc = gltf->AddAccessorWithView(
-              *gltf->GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER),
-              GLT_VEC3F,
-              positions,
-              channel.name);
-          pAcc->min = toStdVec(shapeBounds.min);
-          pAcc->max = toStdVec(shapeBounds.max);
 
           std::shared_ptr<AccessorData> nAcc;
-          if (!normals.empty()) {
-            nAcc = gltf->AddAccessorWithView(
-                *gltf->GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER),
-                GLT_VEC3F,
-                normals,
-                channel.name);
+          if (hasNormals) {
+            nAcc = addDeltas([](const RawBlendVertex& blend) { return blend.normal; }, false);
           }
 
+          // morph target tangent deltas have no handedness component
           std::shared_ptr<AccessorData> tAcc;
-          if (!tangents.empty()) {
-            nAcc = gltf->AddAccessorWithView(
-                *gltf->GetAlignedBufferView(buffer, BufferViewData::GL_ARRAY_BUFFER),
-                GLT_VEC4F,
-                tangents,
-                channel.name);
+          if (hasTangents) {
+            tAcc = addDeltas(
+                [](const RawBlendVertex& blend) { return blend.tangent.xyz(); }, false);
           }
 
           primitive->AddTarget(pAcc.get(), nAcc.get(), tAcc.get());
@@ -637,34 +1513,53 @@ ModelData* Raw2Gltf(
       }
       mesh->AddPrimitive(primitive);
     }
+    if (verboseOutput && inertTargetCount > 0) {
+      fmt::printf(
+          "%lu blend shape target attributes move none of their primitive's vertices, and share "
+          "one all-zero accessor.\n",
+          inertTargetCount);
+    }
 
     //
     // Assign meshes to node
     //
 
+    // all skins' inverse bind matrices share one bufferView; nothing else is written meanwhile
+    std::shared_ptr<BufferViewData> inverseBindMatricesView;
     for (int i = 0; i < raw.GetNodeCount(); i++) {
       const RawNode& node = raw.GetNode(i);
-      auto nodeData = gltf->nodes.ptrs[i];
 
       //
       // Assign mesh to node
       //
-      if (node.surfaceId > 0) {
+      if (hasMesh(node)) {
         int surfaceIndex = raw.GetSurfaceById(node.surfaceId);
         const RawSurface& rawSurface = raw.GetSurface(surfaceIndex);
 
         MeshData& meshData = require(meshBySurfaceId, rawSurface.id);
-        nodeData->SetMesh(meshData.ix);
+        meshNodeOf(node).SetMesh(meshData.ix);
+        auto lodIter = lodNodesById.find(node.id);
+        if (lodIter != lodNodesById.end()) {
+          for (size_t level = 0; level < lodIter->second.size(); level++) {
+            lodIter->second[level]->SetMesh(
+                require(lodMeshesBySurfaceId[level], rawSurface.id).ix);
+          }
+        }
 
         //
         // surface skin
         //
         if (!rawSurface.jointIds.empty()) {
-          if (nodeData->skin == -1) {
-            // glTF uses column-major matrices
+          if (meshNodeOf(node).skin == -1) {
+            // glTF uses column-major matrices; quantized positions must be dequantized first
+            Mat4f dequantization = Mat4f::Identity();
+            auto quantizationIter = positionQuantization.find(rawSurface.id);
+            if (quantizationIter != positionQuantization.end()) {
+              dequantization = quantizationIter->second.dequantization();
+            }
             std::vector<Mat4f> inverseBindMatrices;
             for (const auto& inverseBindMatrice : rawSurface.inverseBindMatrices) {
-              inverseBindMatrices.push_back(inverseBindMatrice.Transpose());
+              inverseBindMatrices.push_back(inverseBindMatrice.Transpose() * dequantization);
             }
 
             std::vector<uint32_t> jointIndexes;
@@ -673,11 +1568,21 @@ ModelData* Raw2Gltf(
             }
 
             // Write out inverseBindMatrices
-            auto accIBM = gltf->AddAccessorAndView(buffer, GLT_MAT4F, inverseBindMatrices);
+            if (!inverseBindMatricesView) {
+              inverseBindMatricesView =
+                  gltf->GetAlignedBufferView(geometryBuffer, BufferViewData::GL_ARRAY_NONE);
+            }
+            auto accIBM = gltf->AddAccessorWithView(
+                *inverseBindMatricesView, GLT_MAT4F, inverseBindMatrices, "");
 
             auto skeletonRoot = require(nodesById, rawSurface.skeletonRootId);
             auto skin = *gltf->skins.hold(new SkinData(jointIndexes, *accIBM, skeletonRoot));
-            nodeData->SetSkin(skin.ix);
+            meshNodeOf(node).SetSkin(skin.ix);
+            if (lodIter != lodNodesById.end()) {
+              for (const auto& lodNode : lodIter->second) {
+                lodNode->SetSkin(skin.ix);
+              }
+            }
           }
         }
       }
@@ -760,6 +1665,9 @@ ModelData* Raw2Gltf(
   NodeData& rootNode = require(nodesById, raw.GetRootNode());
   const SceneData& rootScene = *gltf->scenes.hold(new SceneData(DEFAULT_SCENE_NAME, rootNode));
 
+  // this must come before any JSON is written, which refers to the encoded data
+  const bool usesMeshopt = gltf->CompressMeshoptBufferViews();
+
   if (options.outputBinary) {
     // note: glTF binary is little-endian
     const char glbHeader[] = {
@@ -804,19 +1712,43 @@ ModelData* Raw2Gltf(
       extensionsUsed.push_back(KHR_DRACO_MESH_COMPRESSION);
       extensionsRequired.push_back(KHR_DRACO_MESH_COMPRESSION);
     }
+    if (options.ktx2.enabled && !gltf->textures.ptrs.empty()) {
+      extensionsUsed.push_back(KHR_TEXTURE_BASISU);
+      extensionsRequired.push_back(KHR_TEXTURE_BASISU);
+    }
+    if (options.quantizeMeshes && !gltf->meshes.ptrs.empty()) {
+      extensionsUsed.push_back(KHR_MESH_QUANTIZATION);
+      extensionsRequired.push_back(KHR_MESH_QUANTIZATION);
+    }
+    if (!lodModels.empty()) {
+      // viewers that don't know MSFT_lod just show the full meshes
+      extensionsUsed.push_back(MSFT_LOD);
+    }
+    if (usesMeshopt) {
+      // the fallback buffer has no data, so there's no doing without
+      extensionsUsed.push_back(EXT_MESHOPT_COMPRESSION);
+      extensionsRequired.push_back(EXT_MESHOPT_COMPRESSION);
+    }
 
-    json glTFJson{{"asset", {{"generator", "FBX2glTF v" + FBX2GLTF_VERSION}, {"version", "2.0"}}},
-                  {"scene", rootScene.ix}};
+    JsonWriter writer(gltfOutStream, options.outputBinary ? 0 : 4);
+    writer.beginObject();
+    writer.key("asset")
+        .beginObject()
+        .member("generator", "FBX2glTF v" + FBX2GLTF_VERSION)
+        .member("version", "2.0")
+        .endObject();
+    writer.member("scene", rootScene.ix);
     if (!extensionsUsed.empty()) {
-      glTFJson["extensionsUsed"] = extensionsUsed;
+      writer.member("extensionsUsed", extensionsUsed);
     }
     if (!extensionsRequired.empty()) {
-      glTFJson["extensionsRequired"] = extensionsRequired;
+      writer.member("extensionsRequired", extensionsRequired);
     }
 
-    gltf->serializeHolders(glTFJson);
+    gltf->writeHolders(writer);
 
-    gltfOutStream << glTFJson.dump(options.outputBinary ? 0 : 4);
+    writer.endObject();
+    writer.flush();
   }
   if (options.outputBinary) {
     uint32_t jsonLength = (uint32_t)gltfOutStream.tellp() - 20;
@@ -840,9 +1772,10 @@ ModelData* Raw2Gltf(
     };
     gltfOutStream.write(glb2BinaryHeader, 8);
 
-    // append binary buffer directly to .glb file
+    // stream the binary buffer straight into the .glb file; deferred segments (most geometry and
+    // animation) are produced one at a time as we go, so the buffer is never materialized whole
     size_t binaryLength = gltf->binary->size();
-    gltfOutStream.write((const char*)&(*gltf->binary)[0], binaryLength);
+    gltf->binary->writeTo(gltfOutStream);
     while ((binaryLength % 4) != 0) {
       gltfOutStream.put('\0');
       binaryLength++;
@@ -877,5 +1810,7 @@ ModelData* Raw2Gltf(
     gltfOutStream.seekp(0, std::ios::end);
   }
 
+  // note that in glb mode, the binary's deferred segments refer to our local materialModels and
+  // lodModels; the caller must not try to write it out again
   return new ModelData(gltf->binary);
 }
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstring>
 #include <memory>
 #include <string>
 
@@ -16,11 +17,17 @@
 #include <draco/compression/encode.h>
 
 #include "FBX2glTF.h"
+#include "gltf/ChunkedBuffer.hpp"
+#include "gltf/JsonWriter.hpp"
 #include "raw/RawModel.hpp"
 
 const std::string KHR_DRACO_MESH_COMPRESSION = "KHR_draco_mesh_compression";
 const std::string KHR_MATERIALS_CMN_UNLIT = "KHR_materials_unlit";
 const std::string KHR_LIGHTS_PUNCTUAL = "KHR_lights_punctual";
+const std::string KHR_TEXTURE_BASISU = "KHR_texture_basisu";
+const std::string EXT_MESHOPT_COMPRESSION = "EXT_meshopt_compression";
+const std::string KHR_MESH_QUANTIZATION = "KHR_mesh_quantization";
+const std::string MSFT_LOD = "MSFT_lod";
 
 const std::string extBufferFilename = "buffer.bin";
 
@@ -40,17 +47,24 @@ struct ComponentType {
   const unsigned int size;
 };
 
+const ComponentType CT_BYTE = {ComponentType::GL_BYTE, 1};
+const ComponentType CT_UBYTE = {ComponentType::GL_UNSIGNED_BYTE, 1};
+const ComponentType CT_SHORT = {ComponentType::GL_SHORT, 2};
 const ComponentType CT_USHORT = {ComponentType::GL_UNSIGNED_SHORT, 2};
 const ComponentType CT_UINT = {ComponentType::GL_UNSIGNED_INT, 4};
 const ComponentType CT_FLOAT = {ComponentType::GL_FLOAT, 4};
 
 // Map our low-level data types for glTF output
 struct GLType {
-  GLType(const ComponentType& componentType, unsigned int count, const std::string dataType)
-      : componentType(componentType), count(count), dataType(dataType) {}
+  GLType(
+      const ComponentType& componentType,
+      unsigned int count,
+      const std::string dataType,
+      unsigned int padding = 0)
+      : componentType(componentType), count(count), dataType(dataType), padding(padding) {}
 
   unsigned int byteStride() const {
-    return componentType.size * count;
+    return componentType.size * count + padding;
   }
 
   void write(uint8_t* buf, const float scalar) const {
@@ -72,9 +86,12 @@ struct GLType {
 
   template <class T, int d>
   void write(uint8_t* buf, const mathfu::Vector<T, d>& vector) const {
-    for (int ii = 0; ii < d; ii++) {
+    // the vector may have components to spare, e.g. when the type is padded out
+    assert(d >= count);
+    for (int ii = 0; ii < count; ii++) {
       ((T*)buf)[ii] = vector(ii);
     }
+    memset(&buf[count * sizeof(T)], 0, padding);
   }
   template <class T, int d>
   void write(uint8_t* buf, const mathfu::Matrix<T, d>& matrix) const {
@@ -101,15 +118,27 @@ struct GLType {
   const ComponentType componentType;
   const uint8_t count;
   const std::string dataType;
+  // bytes of zeroes after each element: glTF wants vertex attributes aligned to 4 bytes, so e.g.
+  // a VEC3 of shorts takes up 8 bytes there, and its bufferView needs an explicit byteStride
+  const uint8_t padding;
 };
 
 const GLType GLT_FLOAT = {CT_FLOAT, 1, "SCALAR"};
+const GLType GLT_UBYTE = {CT_UBYTE, 1, "SCALAR"};
 const GLType GLT_USHORT = {CT_USHORT, 1, "SCALAR"};
 const GLType GLT_UINT = {CT_UINT, 1, "SCALAR"};
 const GLType GLT_VEC2F = {CT_FLOAT, 2, "VEC2"};
 const GLType GLT_VEC3F = {CT_FLOAT, 3, "VEC3"};
 const GLType GLT_VEC4F = {CT_FLOAT, 4, "VEC4"};
 const GLType GLT_VEC4I = {CT_USHORT, 4, "VEC4"};
+const GLType GLT_VEC4UB = {CT_UBYTE, 4, "VEC4"};
+const GLType GLT_VEC4S = {CT_SHORT, 4, "VEC4"};
+const GLType GLT_VEC3S = {CT_SHORT, 3, "VEC3"};
+const GLType GLT_VEC3S_PADDED = {CT_SHORT, 3, "VEC3", 2};
+const GLType GLT_VEC4B = {CT_BYTE, 4, "VEC4"};
+const GLType GLT_VEC3B = {CT_BYTE, 3, "VEC3"};
+const GLType GLT_VEC3B_PADDED = {CT_BYTE, 3, "VEC3", 1};
+const GLType GLT_VEC2I = {CT_USHORT, 2, "VEC2"};
 const GLType GLT_MAT2F = {CT_USHORT, 4, "MAT2"};
 const GLType GLT_MAT3F = {CT_USHORT, 9, "MAT3"};
 const GLType GLT_MAT4F = {CT_FLOAT, 16, "MAT4"};
@@ -121,7 +150,16 @@ const GLType GLT_QUATF = {CT_FLOAT, 4, "VEC4"};
 struct Holdable {
   uint32_t ix = UINT_MAX;
 
-  virtual json serialize() const = 0;
+  /**
+   * This entity's JSON, as a DOM. Every subclass must override this or write(), each of which is
+   * by default implemented in terms of the other.
+   */
+  virtual json serialize() const;
+  /**
+   * Stream this entity's JSON straight into the writer. The high-volume entities (accessors, nodes,
+   * meshes and so on) override this, so that the glTF JSON is never built as one big DOM.
+   */
+  virtual void write(JsonWriter& writer) const;
 };
 
 template <class T>
@@ -172,10 +210,9 @@ struct SkinData;
 struct TextureData;
 
 struct ModelData {
-  explicit ModelData(std::shared_ptr<const std::vector<uint8_t>> const& _binary)
-      : binary(_binary) {}
+  explicit ModelData(std::shared_ptr<const ChunkedBuffer> const& _binary) : binary(_binary) {}
 
-  std::shared_ptr<const std::vector<uint8_t>> const binary;
+  std::shared_ptr<const ChunkedBuffer> const binary;
 };
 
 ModelData* Raw2Gltf(
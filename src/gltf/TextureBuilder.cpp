@@ -12,12 +12,373 @@
 #include <stb_image_write.h>
 
 #include <utils/File_Utils.hpp>
+#include <utils/Hash_Utils.hpp>
 #include <utils/Image_Utils.hpp>
+#include <utils/Parallel_Utils.hpp>
 #include <utils/String_Utils.hpp>
 
 #include <gltf/properties/ImageData.hpp>
 #include <gltf/properties/TextureData.hpp>
 
+// the approximate GPU memory footprint of an uncompressed RGBA texture, with a full mip chain
+static uint64_t gpuBytes(int width, int height) {
+  return (uint64_t)width * height * 4 * 4 / 3;
+}
+
+static int floorPowerOfTwo(int n) {
+  int result = 1;
+  while (result * 2 <= n) {
+    result *= 2;
+  }
+  return result;
+}
+
+static ImageUtils::ImageColorSpace colorSpaceForUsage(RawTextureUsage usage) {
+  switch (usage) {
+    case RAW_TEXTURE_USAGE_NORMAL:
+      return ImageUtils::IMAGE_NORMAL_MAP;
+    case RAW_TEXTURE_USAGE_SHININESS:
+    case RAW_TEXTURE_USAGE_OCCLUSION:
+    case RAW_TEXTURE_USAGE_ROUGHNESS:
+    case RAW_TEXTURE_USAGE_METALLIC:
+      return ImageUtils::IMAGE_LINEAR;
+    default:
+      return ImageUtils::IMAGE_SRGB;
+  }
+}
+
+static bool encodeImage(
+    const std::vector<uint8_t>& pixels,
+    int width,
+    int height,
+    int channels,
+    bool png,
+    std::vector<char>& imgBuffer) {
+  if (png) {
+    return stbi_write_png_to_func(
+               TextureBuilder::WriteToVectorContext,
+               &imgBuffer,
+               width,
+               height,
+               channels,
+               pixels.data(),
+               width * channels) != 0;
+  }
+  return stbi_write_jpg_to_func(
+             TextureBuilder::WriteToVectorContext,
+             &imgBuffer,
+             width,
+             height,
+             channels,
+             pixels.data(),
+             80) != 0;
+}
+
+// a tiny transparent PNG, for textures whose image we somehow failed to produce
+static ImageData* fallbackImage(const std::string& name) {
+  return new ImageData(
+      name,
+      "data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlEQVR42mP8/5+hHgAHggJ/PchI7wAAAABJRU5ErkJggg==");
+}
+
+TextureBuilder::TextureBuilder(
+    const RawModel& raw,
+    const GltfOptions& options,
+    const std::string& outputFolder,
+    GltfModel& gltf)
+    : raw(raw), options(options), outputFolder(outputFolder), gltf(gltf) {
+  findIdenticalTextures();
+  computeTargetSizes();
+}
+
+void TextureBuilder::findIdenticalTextures() {
+  const int textureCount = raw.GetTextureCount();
+
+  // hashing means reading every texture file in full, so spread it across the worker pool
+  std::vector<std::pair<uint64_t, uint64_t>> contentKeys(textureCount);
+  std::vector<char> hashed(textureCount, 0); // not vector<bool>, which workers can't share
+  ParallelUtils::ForEach(textureCount, [&](size_t ix) {
+    const std::string& fileLocation = raw.GetTexture((int)ix).fileLocation;
+    hashed[ix] = !fileLocation.empty() &&
+        HashUtils::HashFile(fileLocation, contentKeys[ix].first, contentKeys[ix].second);
+  });
+
+  // map each texture to the first one with the same (hash, size); given 64 bits of hash, we're
+  // content to treat a match as byte-identical
+  std::map<std::pair<uint64_t, uint64_t>, int> firstWithContent;
+  int duplicateCount = 0;
+  for (int ix = 0; ix < textureCount; ix++) {
+    int canonical = ix;
+    if (hashed[ix]) {
+      auto iter = firstWithContent.insert(std::make_pair(contentKeys[ix], ix)).first;
+      canonical = iter->second;
+    }
+    if (canonical != ix) {
+      duplicateCount++;
+      if (verboseOutput) {
+        fmt::printf(
+            "Texture '%s' is identical to '%s'; sharing its image.\n",
+            raw.GetTexture(ix).fileLocation,
+            raw.GetTexture(canonical).fileLocation);
+      }
+    }
+    canonicalTextures.push_back(canonical);
+  }
+  if (verboseOutput && duplicateCount > 0) {
+    fmt::printf("Found %d duplicate texture(s) by content.\n", duplicateCount);
+  }
+}
+
+void TextureBuilder::computeTargetSizes() {
+  const auto& resize = options.textureResize;
+
+  uint64_t totalBytes = 0;
+  for (int ix = 0; ix < raw.GetTextureCount(); ix++) {
+    if (canonicalTextures[ix] != ix) {
+      // duplicates share their image, and so its size; see below
+      targetSizes.push_back(targetSizes[canonicalTextures[ix]]);
+      continue;
+    }
+    const RawTexture& texture = raw.GetTexture(ix);
+    int width = texture.width;
+    int height = texture.height;
+    if (width <= 0 || height <= 0) {
+      // unreadable, or of unknown size; pass it through as it is
+      targetSizes.emplace_back(width, height);
+      continue;
+    }
+    if (resize.maxSize > 0 && std::max(width, height) > resize.maxSize) {
+      const double scale = (double)resize.maxSize / std::max(width, height);
+      width = std::max(1, (int)(width * scale));
+      height = std::max(1, (int)(height * scale));
+    }
+    if (resize.powerOfTwo) {
+      width = floorPowerOfTwo(width);
+      height = floorPowerOfTwo(height);
+    }
+    targetSizes.emplace_back(width, height);
+    totalBytes += gpuBytes(width, height);
+  }
+
+  if (resize.budget > 0 && totalBytes > resize.budget) {
+    if (verboseOutput) {
+      fmt::printf(
+          "Textures need %3.1f MB of GPU memory; shrinking to fit budget of %3.1f MB.\n",
+          totalBytes * 1e-6,
+          resize.budget * 1e-6);
+    }
+    // repeatedly halve whichever texture is currently the most expensive one
+    while (totalBytes > resize.budget) {
+      int largest = -1;
+      for (int ix = 0; ix < (int)targetSizes.size(); ix++) {
+        if (canonicalTextures[ix] != ix || targetSizes[ix].first <= 0 ||
+            targetSizes[ix].second <= 0) {
+          continue;
+        }
+        if (largest < 0 ||
+            gpuBytes(targetSizes[ix].first, targetSizes[ix].second) >
+                gpuBytes(targetSizes[largest].first, targetSizes[largest].second)) {
+          largest = ix;
+        }
+      }
+      if (largest < 0) {
+        break;
+      }
+      std::pair<int, int>& size = targetSizes[largest];
+      if (size.first == 1 && size.second == 1) {
+        break;
+      }
+      totalBytes -= gpuBytes(size.first, size.second);
+      size.first = std::max(1, size.first / 2);
+      size.second = std::max(1, size.second / 2);
+      totalBytes += gpuBytes(size.first, size.second);
+    }
+  }
+
+  for (int ix = 0; ix < raw.GetTextureCount(); ix++) {
+    targetSizes[ix] = targetSizes[canonicalTextures[ix]];
+  }
+}
+
+bool TextureBuilder::isResized(int rawTexIndex) const {
+  const RawTexture& texture = raw.GetTexture(rawTexIndex);
+  return targetSizes[rawTexIndex].first != texture.width ||
+      targetSizes[rawTexIndex].second != texture.height;
+}
+
+bool TextureBuilder::encodePending(PendingImage& pending) const {
+  if (!pending.sourceFile.empty()) {
+    uint8_t* pixels = stbi_load(
+        pending.sourceFile.c_str(), &pending.width, &pending.height, &pending.channels, 0);
+    if (pixels == nullptr) {
+      fmt::printf("Warning: texture %s could not be loaded.\n", pending.sourceFile);
+      return false;
+    }
+    pending.pixels.assign(pixels, pixels + pending.width * pending.height * pending.channels);
+    stbi_image_free(pixels);
+  }
+
+  int width = pending.width;
+  int height = pending.height;
+  const int newWidth = std::min(width, pending.targetWidth);
+  const int newHeight = std::min(height, pending.targetHeight);
+  if (newWidth != width || newHeight != height) {
+    pending.pixels = ImageUtils::ResizeImage(
+        pending.pixels.data(),
+        width,
+        height,
+        pending.channels,
+        newWidth,
+        newHeight,
+        pending.colorSpace);
+    if (verboseOutput) {
+      fmt::printf(
+          "Resized texture '%s' from %dx%d to %dx%d.\n",
+          pending.name,
+          width,
+          height,
+          newWidth,
+          newHeight);
+    }
+    width = newWidth;
+    height = newHeight;
+  }
+
+  bool success;
+  if (options.ktx2.enabled) {
+    success = ImageUtils::EncodeKtx2(
+        pending.pixels.data(),
+        width,
+        height,
+        pending.channels,
+        pending.colorSpace,
+        options.ktx2.uastc,
+        options.ktx2.mipmaps,
+        pending.imgBuffer);
+    pending.filename += ".ktx2";
+    pending.mimeType = "image/ktx2";
+  } else {
+    // JPEG can't hold alpha, so anything with an alpha channel becomes a PNG
+    const bool png = pending.png || pending.channels == 2 || pending.channels == 4;
+    success =
+        encodeImage(pending.pixels, width, height, pending.channels, png, pending.imgBuffer);
+    pending.filename += png ? ".png" : ".jpg";
+    pending.mimeType = png ? "image/png" : "image/jpeg";
+  }
+  if (!success) {
+    fmt::printf("Warning: failed to encode texture '%s'.\n", pending.name);
+  }
+  // we're done with the pixels; don't hang on to them until every other image is encoded
+  std::vector<uint8_t>().swap(pending.pixels);
+  return success;
+}
+
+void TextureBuilder::finish() {
+  ParallelUtils::ForEach(pendingImages.size(), [&](size_t ix) {
+    PendingImage& pending = pendingImages[ix];
+    if (!pending.encoded) {
+      pending.encoded = encodePending(pending);
+    }
+  });
+
+  // writing the images (and growing the glTF) happens in queue order, for deterministic output;
+  // generated images may well turn out identical to each other, so they're shared by content too
+  std::map<std::pair<uint64_t, size_t>, std::shared_ptr<ImageData>> imageByContent;
+  for (PendingImage& pending : pendingImages) {
+    std::shared_ptr<ImageData> image;
+    if (pending.encoded) {
+      const auto key = std::make_pair(
+          HashUtils::Hash64(pending.imgBuffer.data(), pending.imgBuffer.size()),
+          pending.imgBuffer.size());
+      auto iter = imageByContent.find(key);
+      if (iter != imageByContent.end()) {
+        image = iter->second;
+      } else {
+        ImageData* written = writeImage(
+            pending.name, uniqueFilename(pending), pending.imgBuffer, pending.mimeType);
+        if (written != nullptr) {
+          image = gltf.images.hold(written);
+          imageByContent[key] = image;
+        }
+      }
+    }
+    const bool isKtx2 = image != nullptr && options.ktx2.enabled;
+    if (image == nullptr) {
+      image = gltf.images.hold(fallbackImage(pending.name));
+    }
+    for (const auto& texture : pending.textures) {
+      texture->SetSource(*image, isKtx2);
+    }
+  }
+  pendingImages.clear();
+}
+
+// the same source can be re-encoded once per color space, and sources in different folders can
+// share a name; each distinct image gets a file of its own, the first one keeping the plain name
+std::string TextureBuilder::uniqueFilename(const PendingImage& pending) {
+  const size_t dot = pending.filename.rfind('.');
+  const std::string base = pending.filename.substr(0, dot);
+  const std::string suffix = dot == std::string::npos ? "" : pending.filename.substr(dot);
+
+  std::string filename = pending.filename;
+  if (usedFilenames.count(filename) > 0 && pending.colorSpace != ImageUtils::IMAGE_SRGB) {
+    filename = base + "_linear" + suffix;
+  }
+  for (int ix = 2; usedFilenames.count(filename) > 0; ix++) {
+    filename = base + "_" + std::to_string(ix) + suffix;
+  }
+  usedFilenames.insert(filename);
+  return filename;
+}
+
+// whether the file at path already holds exactly these bytes, e.g. from an earlier conversion
+static bool isUnchanged(const std::string& path, const std::vector<char>& contents) {
+  uint64_t fileHash, fileSize;
+  boost::system::error_code ec;
+  if (boost::filesystem::file_size(path, ec) != contents.size() || ec ||
+      !HashUtils::HashFile(path, fileHash, fileSize)) {
+    return false;
+  }
+  return fileSize == contents.size() &&
+      fileHash == HashUtils::Hash64(contents.data(), contents.size());
+}
+
+ImageData* TextureBuilder::writeImage(
+    const std::string& name,
+    const std::string& filename,
+    const std::vector<char>& imgBuffer,
+    const std::string& mimeType) {
+  if (options.outputBinary) {
+    const auto bufferView = gltf.AddContentBufferView(
+        *gltf.defaultBuffer, imgBuffer.data(), to_uint32(imgBuffer.size()));
+    return new ImageData(name, *bufferView, mimeType);
+  }
+
+  const std::string imagePath = outputFolder + filename;
+  if (isUnchanged(imagePath, imgBuffer)) {
+    if (verboseOutput) {
+      fmt::printf("Texture '%s' is unchanged; not rewriting it.\n", imagePath);
+    }
+    return new ImageData(name, filename);
+  }
+  FILE* fp = fopen(imagePath.c_str(), "wb");
+  if (fp == nullptr) {
+    fmt::printf("Warning:: Couldn't write file '%s' for writing.\n", imagePath);
+    return nullptr;
+  }
+
+  if (fwrite(imgBuffer.data(), imgBuffer.size(), 1, fp) != 1) {
+    fmt::printf("Warning: Failed to write %lu bytes to file '%s'.\n", imgBuffer.size(), imagePath);
+    fclose(fp);
+    return nullptr;
+  }
+  fclose(fp);
+  if (verboseOutput) {
+    fmt::printf("Wrote %lu bytes to texture '%s'.\n", imgBuffer.size(), imagePath);
+  }
+  return new ImageData(name, filename);
+}
+
 // keep track of some texture data as we load them
 struct TexInfo {
   explicit TexInfo(int rawTexIx) : rawTexIx(rawTexIx) {}
@@ -34,7 +395,12 @@ std::shared_ptr<TextureData> TextureBuilder::combine(
     const std::string& tag,
     const pixel_merger& computePixel,
     bool includeAlphaChannel) {
-  const std::string key = texIndicesKey(ixVec, tag);
+  // textures with identical content make for identical merges
+  std::vector<int> sourceIxVec;
+  for (const int rawTexIx : ixVec) {
+    sourceIxVec.push_back(rawTexIx >= 0 ? canonicalTextures[rawTexIx] : rawTexIx);
+  }
+  const std::string key = texIndicesKey(sourceIxVec, tag);
   auto iter = textureByIndicesKey.find(key);
   if (iter != textureByIndicesKey.end()) {
     return iter->second;
@@ -43,7 +409,7 @@ std::shared_ptr<TextureData> TextureBuilder::combine(
   int width = -1, height = -1;
   std::string mergedFilename = tag;
   std::vector<TexInfo> texes{};
-  for (const int rawTexIx : ixVec) {
+  for (const int rawTexIx : sourceIxVec) {
     TexInfo info(rawTexIx);
     if (rawTexIx >= 0) {
       const RawTexture& rawTex = raw.GetTexture(rawTexIx);
@@ -114,57 +480,43 @@ std::shared_ptr<TextureData> TextureBuilder::combine(
     }
   }
 
+  // the merged texture is subject to the same size constraints as its first source texture
+  PendingImage pending;
+  pending.name = mergedName;
+  pending.filename = mergedFilename;
+  pending.pixels = std::move(mergedPixels);
+  pending.width = width;
+  pending.height = height;
+  pending.channels = channels;
+  pending.targetWidth = width;
+  pending.targetHeight = height;
+  for (const TexInfo& tex : texes) {
+    if (tex.pixels != nullptr) {
+      pending.targetWidth = targetSizes[tex.rawTexIx].first;
+      pending.targetHeight = targetSizes[tex.rawTexIx].second;
+      break;
+    }
+  }
+  for (const TexInfo& tex : texes) {
+    if (tex.pixels != nullptr) {
+      stbi_image_free(tex.pixels);
+    }
+  }
+  pending.colorSpace = ImageUtils::IMAGE_LINEAR;
   // write a .png iff we need transparency in the destination texture
-  bool png = includeAlphaChannel;
+  pending.png = includeAlphaChannel;
 
-  std::vector<char> imgBuffer;
-  int res;
-  if (png) {
-    res = stbi_write_png_to_func(
-        WriteToVectorContext,
-        &imgBuffer,
-        width,
-        height,
-        channels,
-        mergedPixels.data(),
-        width * channels);
-  } else {
-    res = stbi_write_jpg_to_func(
-        WriteToVectorContext, &imgBuffer, width, height, channels, mergedPixels.data(), 80);
-  }
-  if (!res) {
-    fmt::printf("Warning: failed to generate merge texture '%s'.\n", mergedFilename);
+  // unlike a simple texture's, a merged image is encoded right away: should that fail, the material
+  // is better off without the texture (and with its factors to match) than with a placeholder
+  pending.encoded = encodePending(pending);
+  if (!pending.encoded) {
     return nullptr;
   }
 
-  ImageData* image;
-  if (options.outputBinary) {
-    const auto bufferView =
-        gltf.AddRawBufferView(*gltf.defaultBuffer, imgBuffer.data(), to_uint32(imgBuffer.size()));
-    image = new ImageData(mergedName, *bufferView, png ? "image/png" : "image/jpeg");
-  } else {
-    const std::string imageFilename = mergedFilename + (png ? ".png" : ".jpg");
-    const std::string imagePath = outputFolder + imageFilename;
-    FILE* fp = fopen(imagePath.c_str(), "wb");
-    if (fp == nullptr) {
-      fmt::printf("Warning:: Couldn't write file '%s' for writing.\n", imagePath);
-      return nullptr;
-    }
-
-    if (fwrite(imgBuffer.data(), imgBuffer.size(), 1, fp) != 1) {
-      fmt::printf(
-          "Warning: Failed to write %lu bytes to file '%s'.\n", imgBuffer.size(), imagePath);
-      fclose(fp);
-      return nullptr;
-    }
-    fclose(fp);
-    if (verboseOutput) {
-      fmt::printf("Wrote %lu bytes to texture '%s'.\n", imgBuffer.size(), imagePath);
-    }
-    image = new ImageData(mergedName, imageFilename);
-  }
-  std::shared_ptr<TextureData> texDat = gltf.textures.hold(
-      new TextureData(mergedName, *gltf.defaultSampler, *gltf.images.hold(image)));
+  std::shared_ptr<TextureData> texDat =
+      gltf.textures.hold(new TextureData(mergedName, *gltf.defaultSampler));
+  pending.textures.push_back(texDat);
+  pendingImages.push_back(std::move(pending));
   textureByIndicesKey.insert(std::make_pair(key, texDat));
   return texDat;
 }
@@ -177,6 +529,68 @@ std::shared_ptr<TextureData> TextureBuilder::simple(int rawTexIndex, const std::
     return iter->second;
   }
 
+  const RawTexture& rawTexture = raw.GetTexture(rawTexIndex);
+  const std::string textureName = FileUtils::GetFileBase(rawTexture.name);
+
+  // every texture gets its own TextureData, but the image comes from the first texture with
+  // identical content
+  const int sourceIndex = canonicalTextures[rawTexIndex];
+  const RawTexture& sourceTexture = raw.GetTexture(sourceIndex);
+  const std::string relativeFilename = FileUtils::GetFileName(sourceTexture.fileLocation);
+
+  std::shared_ptr<TextureData> texDat;
+  if (!relativeFilename.empty() && (isResized(sourceIndex) || options.ktx2.enabled)) {
+    // the image needs re-encoding; leave that to finish()
+    const ImageUtils::ImageColorSpace colorSpace = colorSpaceForUsage(rawTexture.usage);
+    const std::string imageKey = std::to_string(sourceIndex) + "_" + std::to_string(colorSpace);
+    texDat = gltf.textures.hold(new TextureData(textureName, *gltf.defaultSampler));
+
+    auto pendingIter = pendingImageByKey.find(imageKey);
+    if (pendingIter != pendingImageByKey.end()) {
+      pendingImages[pendingIter->second].textures.push_back(texDat);
+    } else {
+      PendingImage pending;
+      pending.textures.push_back(texDat);
+      pending.name = relativeFilename;
+      pending.filename = FileUtils::GetFileBase(relativeFilename);
+      pending.sourceFile = sourceTexture.fileLocation;
+      pending.targetWidth = targetSizes[sourceIndex].first;
+      pending.targetHeight = targetSizes[sourceIndex].second;
+      pending.colorSpace = colorSpace;
+      const auto& suffix = FileUtils::GetFileSuffix(relativeFilename);
+      pending.png = !suffix || ImageUtils::suffixToMimeType(suffix.value()) != "image/jpeg";
+      pendingImageByKey[imageKey] = pendingImages.size();
+      pendingImages.push_back(std::move(pending));
+    }
+
+  } else {
+    texDat = gltf.textures.hold(
+        new TextureData(textureName, *gltf.defaultSampler, *passThroughImage(sourceIndex)));
+  }
+  textureByIndicesKey.insert(std::make_pair(key, texDat));
+  return texDat;
+}
+
+bool TextureBuilder::materializeFile(const std::string& srcPath, const std::string& dstPath) const {
+  switch (options.textureLink) {
+    case TextureLinkOptions::HARDLINK:
+      return FileUtils::HardLinkFile(srcPath, dstPath, true);
+    case TextureLinkOptions::REFLINK:
+      return FileUtils::CloneFile(srcPath, dstPath, true);
+    case TextureLinkOptions::SYMLINK:
+      return FileUtils::SymlinkFile(srcPath, dstPath, true);
+    default:
+      return FileUtils::CopyFile(srcPath, dstPath, true);
+  }
+}
+
+/** Return the ImageData for the given RawTexture's unaltered file, creating it if necessary. */
+std::shared_ptr<ImageData> TextureBuilder::passThroughImage(int rawTexIndex) {
+  auto iter = passThroughImages.find(rawTexIndex);
+  if (iter != passThroughImages.end()) {
+    return iter->second;
+  }
+
   const RawTexture& rawTexture = raw.GetTexture(rawTexIndex);
   const std::string textureName = FileUtils::GetFileBase(rawTexture.name);
   const std::string relativeFilename = FileUtils::GetFileName(rawTexture.fileLocation);
@@ -200,27 +614,24 @@ std::shared_ptr<TextureData> TextureBuilder::simple(int rawTexIndex, const std::
     }
 
   } else if (!relativeFilename.empty()) {
+    usedFilenames.insert(relativeFilename);
     image = new ImageData(relativeFilename, relativeFilename);
     std::string outputPath = outputFolder + "/" + relativeFilename;
-    if (FileUtils::CopyFile(rawTexture.fileLocation, outputPath, true)) {
+    if (materializeFile(rawTexture.fileLocation, outputPath)) {
       if (verboseOutput) {
-        fmt::printf("Copied texture '%s' to output folder: %s\n", textureName, outputPath);
+        fmt::printf("Placed texture '%s' in output folder: %s\n", textureName, outputPath);
       }
     } else {
-      // no point commenting further on read/write error; CopyFile() does enough of that, and we
+      // no point commenting further on read/write error; FileUtils does enough of that, and we
       // certainly want to to add an image struct to the glTF JSON, with the correct relative path
       // reference, even if the copy failed.
     }
   }
   if (!image) {
-    // fallback is tiny transparent PNG
-    image = new ImageData(
-        textureName,
-        "data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlEQVR42mP8/5+hHgAHggJ/PchI7wAAAABJRU5ErkJggg==");
+    image = fallbackImage(textureName);
   }
 
-  std::shared_ptr<TextureData> texDat = gltf.textures.hold(
-      new TextureData(textureName, *gltf.defaultSampler, *gltf.images.hold(image)));
-  textureByIndicesKey.insert(std::make_pair(key, texDat));
-  return texDat;
+  std::shared_ptr<ImageData> result = gltf.images.hold(image);
+  passThroughImages[rawTexIndex] = result;
+  return result;
 }
@@ -9,10 +9,12 @@
 #pragma once
 
 #include <functional>
+#include <set>
 
 #include "FBX2glTF.h"
 
 #include <gltf/properties/ImageData.hpp>
+#include <utils/Image_Utils.hpp>
 
 #include "GltfModel.hpp"
 
@@ -25,8 +27,7 @@ class TextureBuilder {
       const RawModel& raw,
       const GltfOptions& options,
       const std::string& outputFolder,
-      GltfModel& gltf)
-      : raw(raw), options(options), outputFolder(outputFolder), gltf(gltf) {}
+      GltfModel& gltf);
   ~TextureBuilder() {}
 
   std::shared_ptr<TextureData> combine(
@@ -37,6 +38,13 @@ class TextureBuilder {
 
   std::shared_ptr<TextureData> simple(int rawTexIndex, const std::string& tag);
 
+  /**
+   * Encode every image that simple() queued up, in parallel across the texture worker pool, then
+   * write them out, along with those combine() already encoded, and hook them up to their
+   * textures. Call this once, after the last texture has been requested.
+   */
+  void finish();
+
   static std::string texIndicesKey(const std::vector<int>& ixVec, const std::string& tag) {
     std::string result = tag;
     for (int ix : ixVec) {
@@ -68,10 +76,54 @@ class TextureBuilder {
   }
 
  private:
+  void findIdenticalTextures();
+  void computeTargetSizes();
+  bool isResized(int rawTexIndex) const;
+
+  // an image that must be (re-)encoded before it can be written out; see finish()
+  struct PendingImage {
+    std::vector<std::shared_ptr<TextureData>> textures; // all textures that share this image
+    std::string name;
+    std::string filename; // without suffix, until the output format is known
+    std::string sourceFile; // if non-empty, the pixels are loaded from this file
+    std::vector<uint8_t> pixels;
+    int width{};
+    int height{};
+    int channels{};
+    int targetWidth{};
+    int targetHeight{};
+    ImageUtils::ImageColorSpace colorSpace{ImageUtils::IMAGE_SRGB};
+    bool png{}; // unless writing KTX2, whether to encode a PNG even for opaque images
+
+    bool encoded{};
+    std::vector<char> imgBuffer;
+    std::string mimeType;
+  };
+  bool encodePending(PendingImage& pending) const;
+  std::shared_ptr<ImageData> passThroughImage(int rawTexIndex);
+  bool materializeFile(const std::string& srcPath, const std::string& dstPath) const;
+
+  std::string uniqueFilename(const PendingImage& pending);
+  ImageData* writeImage(
+      const std::string& name,
+      const std::string& filename,
+      const std::vector<char>& imgBuffer,
+      const std::string& mimeType);
+
   const RawModel& raw;
   const GltfOptions& options;
   const std::string outputFolder;
   GltfModel& gltf;
 
   std::map<std::string, std::shared_ptr<TextureData>> textureByIndicesKey;
+  // the (width, height) each RawTexture is written out with, once --texture-* options are applied
+  std::vector<std::pair<int, int>> targetSizes;
+  // for each RawTexture, the lowest-indexed RawTexture whose file has identical contents
+  std::vector<int> canonicalTextures;
+
+  std::vector<PendingImage> pendingImages;
+  std::map<std::string, size_t> pendingImageByKey;
+  std::map<int, std::shared_ptr<ImageData>> passThroughImages;
+  // the names of the image files placed in the output folder so far
+  std::set<std::string> usedFilenames;
 };
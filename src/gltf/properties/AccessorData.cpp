@@ -20,21 +20,42 @@ AccessorData::AccessorData(const BufferViewData& bufferView, GLType type, std::s
 AccessorData::AccessorData(GLType type)
     : Holdable(), bufferView(-1), type(std::move(type)), byteOffset(0), count(0) {}
 
-json AccessorData::serialize() const {
-  json result{
-      {"componentType", type.componentType.glType}, {"type", type.dataType}, {"count", count}};
+void AccessorData::write(JsonWriter& writer) const {
+  writer.beginObject()
+      .member("componentType", type.componentType.glType)
+      .member("type", type.dataType)
+      .member("count", count);
+  if (normalized) {
+    writer.member("normalized", true);
+  }
   if (bufferView >= 0) {
-    result["bufferView"] = bufferView;
-    result["byteOffset"] = byteOffset;
+    writer.member("bufferView", bufferView).member("byteOffset", byteOffset);
   }
   if (!min.empty()) {
-    result["min"] = min;
+    writer.member("min", min);
   }
   if (!max.empty()) {
-    result["max"] = max;
+    writer.member("max", max);
+  }
+  if (sparse.count > 0) {
+    writer.key("sparse")
+        .beginObject()
+        .member("count", sparse.count)
+        .key("indices")
+        .beginObject()
+        .member("bufferView", sparse.bufferView)
+        .member("byteOffset", sparse.indicesByteOffset)
+        .member("componentType", sparse.indicesComponentType)
+        .endObject()
+        .key("values")
+        .beginObject()
+        .member("bufferView", sparse.bufferView)
+        .member("byteOffset", sparse.valuesByteOffset)
+        .endObject()
+        .endObject();
   }
   if (name.length() > 0) {
-    result["name"] = name;
+    writer.member("name", name);
   }
-  return result;
+  writer.endObject();
 }
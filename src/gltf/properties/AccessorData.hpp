@@ -8,28 +8,70 @@
 
 #pragma once
 
+#include "gltf/ChunkedBuffer.hpp"
 #include "gltf/Raw2Gltf.hpp"
 
 struct AccessorData : Holdable {
   AccessorData(const BufferViewData& bufferView, GLType type, std::string name);
   explicit AccessorData(GLType type);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   template <class T>
-  void appendAsBinaryArray(const std::vector<T>& in, std::vector<uint8_t>& out) {
+  void appendAsBinaryArray(const std::vector<T>& in, ChunkedBuffer& out) {
     const unsigned int stride = type.byteStride();
-    const size_t offset = out.size();
     const size_t count = in.size();
 
     this->count = (unsigned int)count;
 
-    out.resize(offset + count * stride);
+    uint8_t* dst = out.grow(count * stride);
     for (int ii = 0; ii < count; ii++) {
-      type.write(&out[offset + ii * stride], in[ii]);
+      type.write(&dst[ii * stride], in[ii]);
     }
   }
 
+  /**
+   * Like appendAsBinaryArray(), but the elements are only read when the buffer is written out;
+   * see ChunkedBuffer::defer(). The vector must outlive the buffer.
+   */
+  template <class T>
+  void deferAsBinaryArray(const std::vector<T>& in, ChunkedBuffer& out) {
+    const GLType type = this->type;
+    const unsigned int stride = type.byteStride();
+    const std::vector<T>* source = &in;
+
+    this->count = (unsigned int)in.size();
+
+    out.defer(in.size() * stride, [type, stride, source](uint8_t* dst) {
+      for (size_t ii = 0; ii < source->size(); ii++) {
+        type.write(&dst[ii * stride], (*source)[ii]);
+      }
+    });
+  }
+
+  /**
+   * Like appendAsBinaryArray(), but the count elements are only generated, by the given function,
+   * when the buffer is written out; see ChunkedBuffer::defer().
+   */
+  template <class T>
+  void deferAsBinaryArray(
+      size_t count,
+      const std::function<std::vector<T>()>& generate,
+      ChunkedBuffer& out) {
+    const GLType type = this->type;
+    const unsigned int stride = type.byteStride();
+
+    this->count = (unsigned int)count;
+
+    out.defer(count * stride, [type, stride, count, generate](uint8_t* dst) {
+      const std::vector<T> in = generate();
+      assert(in.size() == count);
+      for (size_t ii = 0; ii < count; ii++) {
+        type.write(&dst[ii * stride], in[ii]);
+      }
+    });
+  }
+
   unsigned int byteLength() const {
     return type.byteStride() * count;
   }
@@ -39,7 +81,18 @@ struct AccessorData : Holdable {
 
   unsigned int byteOffset;
   unsigned int count;
+  // whether integer components map onto [0, 1] (unsigned) or [-1, 1] (signed) when read
+  bool normalized{false};
   std::vector<float> min;
   std::vector<float> max;
   std::string name;
+
+  // if count is positive, all elements are zero except these few; see GltfModel::AddSparseAccessor
+  struct {
+    unsigned int count = 0;
+    int bufferView = -1; // holds both the indices and the values
+    unsigned int indicesByteOffset = 0;
+    ComponentType::GL_DataType indicesComponentType = ComponentType::GL_UNSIGNED_INT;
+    unsigned int valuesByteOffset = 0;
+  } sparse;
 };
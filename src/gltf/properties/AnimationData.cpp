@@ -28,27 +28,41 @@ void AnimationData::AddNodeChannel(
   samplers.emplace_back(sampler_t(timeAccessor, accessor.ix));
 }
 
-json AnimationData::serialize() const {
-  return {{"name", name}, {"channels", channels}, {"samplers", samplers}};
+void AnimationData::AddNodeChannel(
+    const NodeData& node,
+    const AccessorData& inputAccessor,
+    const AccessorData& accessor,
+    std::string path) {
+  assert(channels.size() == samplers.size());
+  uint32_t ix = to_uint32(channels.size());
+  channels.emplace_back(channel_t(ix, node, std::move(path)));
+  samplers.emplace_back(sampler_t(inputAccessor.ix, accessor.ix));
+}
+
+void AnimationData::write(JsonWriter& writer) const {
+  writer.beginObject().member("name", name).key("channels").beginArray();
+  for (const channel_t& channel : channels) {
+    writer.beginObject()
+        .member("sampler", channel.ix)
+        .key("target")
+        .beginObject()
+        .member("node", channel.node)
+        .member("path", channel.path)
+        .endObject()
+        .endObject();
+  }
+  writer.endArray().key("samplers").beginArray();
+  for (const sampler_t& sampler : samplers) {
+    writer.beginObject()
+        .member("input", sampler.time)
+        .member("interpolation", "LINEAR")
+        .member("output", sampler.output)
+        .endObject();
+  }
+  writer.endArray().endObject();
 }
 
 AnimationData::channel_t::channel_t(uint32_t ix, const NodeData& node, std::string path)
     : ix(ix), node(node.ix), path(std::move(path)) {}
 
 AnimationData::sampler_t::sampler_t(uint32_t time, uint32_t output) : time(time), output(output) {}
-
-void to_json(json& j, const AnimationData::channel_t& data) {
-  j = json{{"sampler", data.ix},
-           {
-               "target",
-               {{"node", data.node}, {"path", data.path}},
-           }};
-}
-
-void to_json(json& j, const AnimationData::sampler_t& data) {
-  j = json{
-      {"input", data.time},
-      {"interpolation", "LINEAR"},
-      {"output", data.output},
-  };
-}
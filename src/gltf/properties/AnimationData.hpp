@@ -16,8 +16,14 @@ struct AnimationData : Holdable {
   // assumption: 1-to-1 relationship between channels and samplers; this is a simplification on what
   // glTF can express, but it means we can rely on samplerIx == channelIx throughout an animation
   void AddNodeChannel(const NodeData& node, const AccessorData& accessor, std::string path);
+  // as above, but with keyframes at their own times, rather than at the animation's
+  void AddNodeChannel(
+      const NodeData& node,
+      const AccessorData& inputAccessor,
+      const AccessorData& accessor,
+      std::string path);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   struct channel_t {
     channel_t(uint32_t _ix, const NodeData& node, std::string path);
@@ -39,6 +45,3 @@ struct AnimationData : Holdable {
   std::vector<channel_t> channels;
   std::vector<sampler_t> samplers;
 };
-
-void to_json(json& j, const AnimationData::channel_t& data);
-void to_json(json& j, const AnimationData::sampler_t& data);
@@ -10,24 +10,78 @@
 
 #include "BufferData.hpp"
 
-BufferData::BufferData(const std::shared_ptr<const std::vector<uint8_t>>& binData)
+#include <algorithm>
+#include <cstring>
+
+// how much binary data to base64-encode at a time; a multiple of 3, so no padding is emitted
+static const size_t BASE64_BLOCK_SIZE = 48 * 1024;
+
+// base64-encode the buffer block by block, straight into the sink, carrying any partial 3-byte
+// group over from one run of the buffer into the next
+static void encodeBase64(const ChunkedBuffer& data, const JsonWriter::StringSink& sink) {
+  std::vector<char> encoded(base64::encoded_size(BASE64_BLOCK_SIZE));
+  auto encodeBlock = [&](const uint8_t* bytes, size_t length) {
+    const size_t encodedLength = base64::encode(encoded.data(), encoded.size(), bytes, length);
+    sink(encoded.data(), encodedLength);
+  };
+
+  uint8_t carry[3];
+  size_t carried = 0;
+  data.forEachRun([&](const uint8_t* run, size_t length) {
+    if (carried > 0) {
+      while (carried < 3 && length > 0) {
+        carry[carried++] = *run++;
+        length--;
+      }
+      if (carried < 3) {
+        return;
+      }
+      encodeBlock(carry, carried);
+      carried = 0;
+    }
+    const size_t whole = length - (length % 3);
+    for (size_t offset = 0; offset < whole; offset += BASE64_BLOCK_SIZE) {
+      encodeBlock(run + offset, std::min(BASE64_BLOCK_SIZE, whole - offset));
+    }
+    carried = length - whole;
+    memcpy(carry, run + whole, carried);
+  });
+  if (carried > 0) {
+    encodeBlock(carry, carried);
+  }
+}
+
+BufferData::BufferData(const std::shared_ptr<const ChunkedBuffer>& binData)
     : Holdable(), isGlb(true), binData(binData) {}
 
 BufferData::BufferData(
     std::string uri,
-    const std::shared_ptr<const std::vector<uint8_t>>& binData,
+    const std::shared_ptr<const ChunkedBuffer>& binData,
     bool isEmbedded)
     : Holdable(), isGlb(false), uri(isEmbedded ? "" : std::move(uri)), binData(binData) {}
 
-json BufferData::serialize() const {
-  json result{{"byteLength", binData->size()}};
-  if (!isGlb) {
+void BufferData::write(JsonWriter& writer) const {
+  writer.beginObject().member("byteLength", binData->size());
+  if (isMeshoptFallback) {
+    writer.key("extensions")
+        .beginObject()
+        .key(EXT_MESHOPT_COMPRESSION)
+        .beginObject()
+        .member("fallback", true)
+        .endObject()
+        .endObject();
+  } else if (!isGlb) {
+    writer.key("uri");
     if (!uri.empty()) {
-      result["uri"] = uri;
+      writer.value(uri);
     } else {
-      std::string encoded = base64::encode(*binData);
-      result["uri"] = "data:application/octet-stream;base64," + encoded;
+      // the data URI would be a third larger than the buffer itself; never hold it in memory
+      writer.streamedValue([&](const JsonWriter::StringSink& sink) {
+        static const std::string prefix = "data:application/octet-stream;base64,";
+        sink(prefix.data(), prefix.size());
+        encodeBase64(*binData, sink);
+      });
     }
   }
-  return result;
+  writer.endObject();
 }
@@ -8,19 +8,22 @@
 
 #pragma once
 
+#include "gltf/ChunkedBuffer.hpp"
 #include "gltf/Raw2Gltf.hpp"
 
 struct BufferData : Holdable {
-  explicit BufferData(const std::shared_ptr<const std::vector<uint8_t>>& binData);
+  explicit BufferData(const std::shared_ptr<const ChunkedBuffer>& binData);
 
   BufferData(
       std::string uri,
-      const std::shared_ptr<const std::vector<uint8_t>>& binData,
+      const std::shared_ptr<const ChunkedBuffer>& binData,
       bool isEmbedded = false);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const bool isGlb;
+  // whether this is the EXT_meshopt_compression fallback buffer, whose data is never written
+  bool isMeshoptFallback = false;
   const std::string uri;
-  const std::shared_ptr<const std::vector<uint8_t>> binData; // TODO this is just weird
+  const std::shared_ptr<const ChunkedBuffer> binData; // TODO this is just weird
 };
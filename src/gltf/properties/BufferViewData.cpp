@@ -15,10 +15,33 @@ BufferViewData::BufferViewData(
     const GL_ArrayType _target)
     : Holdable(), buffer(_buffer.ix), byteOffset((unsigned int)_byteOffset), target(_target) {}
 
-json BufferViewData::serialize() const {
-  json result{{"buffer", buffer}, {"byteLength", byteLength}, {"byteOffset", byteOffset}};
+void BufferViewData::write(JsonWriter& writer) const {
+  writer.beginObject()
+      .member("buffer", buffer)
+      .member("byteLength", byteLength)
+      .member("byteOffset", byteOffset);
+  if (byteStride > 0) {
+    writer.member("byteStride", byteStride);
+  }
   if (target != GL_ARRAY_NONE) {
-    result["target"] = target;
+    writer.member("target", target);
+  }
+  if (meshopt.byteLength > 0) {
+    static const char* const filterNames[] = {"NONE", "OCTAHEDRAL", "QUATERNION", "EXPONENTIAL"};
+    writer.key("extensions")
+        .beginObject()
+        .key(EXT_MESHOPT_COMPRESSION)
+        .beginObject()
+        .member("buffer", meshopt.buffer)
+        .member("byteOffset", meshopt.byteOffset)
+        .member("byteLength", meshopt.byteLength)
+        .member("byteStride", meshopt.byteStride)
+        .member("mode", target == GL_ELEMENT_ARRAY_BUFFER ? "TRIANGLES" : "ATTRIBUTES")
+        .member("count", meshopt.count);
+    if (meshopt.filter != FILTER_NONE) {
+      writer.member("filter", filterNames[meshopt.filter]);
+    }
+    writer.endObject().endObject();
   }
-  return result;
+  writer.endObject();
 }
@@ -17,13 +17,29 @@ struct BufferViewData : Holdable {
     GL_ELEMENT_ARRAY_BUFFER = 34963
   };
 
+  // how EXT_meshopt_compression preprocesses a view's contents before encoding them
+  enum MeshoptFilter { FILTER_NONE, FILTER_OCTAHEDRAL, FILTER_QUATERNION, FILTER_EXPONENTIAL };
+
   BufferViewData(const BufferData& _buffer, const size_t _byteOffset, const GL_ArrayType _target);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const unsigned int buffer;
   const unsigned int byteOffset;
   const GL_ArrayType target;
 
   unsigned int byteLength = 0;
+  // only set for vertex attributes whose elements are padded out; see GLType::padding
+  unsigned int byteStride = 0;
+
+  // if this view lives in the EXT_meshopt_compression fallback buffer, where its encoded contents
+  // went; see GltfModel::CompressMeshoptBufferViews()
+  struct {
+    MeshoptFilter filter = FILTER_NONE;
+    unsigned int buffer = 0;
+    unsigned int byteOffset = 0;
+    unsigned int byteLength = 0; // zero until encoded
+    unsigned int byteStride = 0;
+    unsigned int count = 0;
+  } meshopt;
 };
@@ -18,9 +18,12 @@ ImageData::ImageData(std::string name, std::string uri)
 ImageData::ImageData(std::string name, const BufferViewData& bufferView, std::string mimeType)
     : Holdable(), name(std::move(name)), bufferView(bufferView.ix), mimeType(std::move(mimeType)) {}
 
-json ImageData::serialize() const {
+void ImageData::write(JsonWriter& writer) const {
+  writer.beginObject().member("name", name);
   if (bufferView < 0) {
-    return {{"name", name}, {"uri", uri}};
+    writer.member("uri", uri);
+  } else {
+    writer.member("bufferView", bufferView).member("mimeType", mimeType);
   }
-  return {{"name", name}, {"bufferView", bufferView}, {"mimeType", mimeType}};
+  writer.endObject();
 }
@@ -14,7 +14,7 @@ struct ImageData : Holdable {
   ImageData(std::string name, std::string uri);
   ImageData(std::string name, const BufferViewData& bufferView, std::string mimeType);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const std::string name;
   const std::string uri; // non-empty in gltf mode
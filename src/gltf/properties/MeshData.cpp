@@ -12,23 +12,20 @@
 MeshData::MeshData(const std::string& name, const std::vector<float>& weights)
     : Holdable(), name(name), weights(weights) {}
 
-json MeshData::serialize() const {
-  json jsonPrimitivesArray = json::array();
-  json jsonTargetNamesArray = json::array();
+void MeshData::write(JsonWriter& writer) const {
+  std::vector<std::string> targetNames;
+  writer.beginObject().member("name", name).key("primitives").beginArray();
   for (const auto& primitive : primitives) {
-    jsonPrimitivesArray.push_back(*primitive);
-    if (!primitive->targetNames.empty()) {
-      for (auto targetName : primitive->targetNames) {
-        jsonTargetNamesArray.push_back(targetName);
-      }
-    }
+    primitive->write(writer);
+    targetNames.insert(
+        targetNames.end(), primitive->targetNames.begin(), primitive->targetNames.end());
   }
-  json result = {{"name", name}, {"primitives", jsonPrimitivesArray}};
+  writer.endArray();
   if (!weights.empty()) {
-    result["weights"] = weights;
+    writer.member("weights", weights);
   }
-  if (!jsonTargetNamesArray.empty()) {
-    result["extras"]["targetNames"] = jsonTargetNamesArray;
+  if (!targetNames.empty()) {
+    writer.key("extras").beginObject().member("targetNames", targetNames).endObject();
   }
-  return result;
+  writer.endObject();
 }
@@ -23,7 +23,7 @@ struct MeshData : Holdable {
     primitives.push_back(std::move(primitive));
   }
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const std::string name;
   const std::vector<float> weights;
@@ -52,21 +52,28 @@ void NodeData::SetLight(uint32_t lightIndex) {
   light = lightIndex;
 }
 
-json NodeData::serialize() const {
-  json result = {{"name", name}};
+void NodeData::SetLevelsOfDetail(std::vector<uint32_t> lodIxs, std::vector<float> coverage) {
+  assert(!isJoint);
+  assert(coverage.size() == lodIxs.size() + 1);
+  lods = std::move(lodIxs);
+  screenCoverage = std::move(coverage);
+}
+
+void NodeData::write(JsonWriter& writer) const {
+  writer.beginObject().member("name", name);
 
   // if any of the T/R/S have NaN components, just leave them out of the glTF
-  auto maybeAdd = [&](std::string key, std::vector<float> vec) -> void {
+  auto maybeWrite = [&](const std::string& key, const std::vector<float>& vec) -> void {
     if (std::none_of(vec.begin(), vec.end(), [&](float n) { return std::isnan(n); })) {
-      result[key] = vec;
+      writer.member(key, vec);
     }
   };
-  maybeAdd("translation", toStdVec(translation));
-  maybeAdd("rotation", toStdVec(rotation));
-  maybeAdd("scale", toStdVec(scale));
+  maybeWrite("translation", toStdVec(translation));
+  maybeWrite("rotation", toStdVec(rotation));
+  maybeWrite("scale", toStdVec(scale));
 
   if (!children.empty()) {
-    result["children"] = children;
+    writer.member("children", children);
   }
   if (isJoint) {
     // sanity-check joint node
@@ -74,30 +81,48 @@ json NodeData::serialize() const {
   } else {
     // non-joint node
     if (mesh >= 0) {
-      result["mesh"] = mesh;
+      writer.member("mesh", mesh);
     }
     if (!skeletons.empty()) {
-      result["skeletons"] = skeletons;
+      writer.member("skeletons", skeletons);
     }
     if (skin >= 0) {
-      result["skin"] = skin;
+      writer.member("skin", skin);
     }
     if (camera >= 0) {
-      result["camera"] = camera;
+      writer.member("camera", camera);
     }
-    if (light >= 0) {
-      result["extensions"][KHR_LIGHTS_PUNCTUAL]["light"] = light;
+    if (light >= 0 || !lods.empty()) {
+      writer.key("extensions").beginObject();
+      if (light >= 0) {
+        writer.key(KHR_LIGHTS_PUNCTUAL).beginObject().member("light", light).endObject();
+      }
+      if (!lods.empty()) {
+        writer.key(MSFT_LOD).beginObject().member("ids", lods).endObject();
+      }
+      writer.endObject();
     }
   }
 
-  for (const auto& i : userProperties) {
-    auto& prop_map = result["extras"]["fromFBX"]["userProperties"];
-
-    json j = json::parse(i);
-    for (const auto& k : json::iterator_wrapper(j)) {
-      prop_map[k.key()] = k.value();
+  if (!userProperties.empty() || !screenCoverage.empty()) {
+    writer.key("extras").beginObject();
+    // MSFT_lod's switching hints live in extras, not in the extension itself
+    if (!screenCoverage.empty()) {
+      writer.member("MSFT_screencoverage", screenCoverage);
+    }
+    if (!userProperties.empty()) {
+      // user properties are few and arbitrary; merging them is easiest done in a DOM
+      json prop_map;
+      for (const auto& i : userProperties) {
+        json j = json::parse(i);
+        for (const auto& k : json::iterator_wrapper(j)) {
+          prop_map[k.key()] = k.value();
+        }
+      }
+      writer.key("fromFBX").beginObject().member("userProperties", prop_map).endObject();
     }
+    writer.endObject();
   }
 
-  return result;
+  writer.endObject();
 }
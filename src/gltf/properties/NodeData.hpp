@@ -23,8 +23,11 @@ struct NodeData : Holdable {
   void SetSkin(uint32_t skinIx);
   void SetCamera(uint32_t camera);
   void SetLight(uint32_t light);
+  // the nodes that replace this one as it gets smaller on screen, from most to least detailed;
+  // each coverage is the fraction of the screen below which the next level takes over
+  void SetLevelsOfDetail(std::vector<uint32_t> lodIxs, std::vector<float> coverage);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const std::string name;
   const bool isJoint;
@@ -36,6 +39,8 @@ struct NodeData : Holdable {
   int32_t camera;
   int32_t light;
   int32_t skin;
+  std::vector<uint32_t> lods;
+  std::vector<float> screenCoverage;
   std::vector<std::string> skeletons;
   std::vector<std::string> userProperties;
 };
@@ -48,32 +48,42 @@ void PrimitiveData::AddTarget(
   targetNames.push_back(positions->name);
 }
 
-void to_json(json& j, const PrimitiveData& d) {
-  j = {{"material", d.material}, {"mode", d.mode}, {"attributes", d.attributes}};
-  if (d.indices >= 0) {
-    j["indices"] = d.indices;
+void PrimitiveData::write(JsonWriter& writer) const {
+  writer.beginObject()
+      .member("material", material)
+      .member("mode", mode)
+      .member("attributes", attributes);
+  if (indices >= 0) {
+    writer.member("indices", indices);
   }
-  if (!d.targetAccessors.empty()) {
-    json targets{};
+  if (!targetAccessors.empty()) {
+    writer.key("targets").beginArray();
     int pIx, nIx, tIx;
-    for (auto accessor : d.targetAccessors) {
+    for (const auto& accessor : targetAccessors) {
       std::tie(pIx, nIx, tIx) = accessor;
-      json target{};
+      writer.beginObject();
       if (pIx >= 0) {
-        target["POSITION"] = pIx;
+        writer.member("POSITION", pIx);
       }
       if (nIx >= 0) {
-        target["NORMAL"] = nIx;
+        writer.member("NORMAL", nIx);
       }
       if (tIx >= 0) {
-        target["TANGENT"] = tIx;
+        writer.member("TANGENT", tIx);
       }
-      targets.push_back(target);
+      writer.endObject();
     }
-    j["targets"] = targets;
+    writer.endArray();
   }
-  if (!d.dracoAttributes.empty()) {
-    j["extensions"] = {{KHR_DRACO_MESH_COMPRESSION,
-                        {{"bufferView", d.dracoBufferView}, {"attributes", d.dracoAttributes}}}};
+  if (!dracoAttributes.empty()) {
+    writer.key("extensions")
+        .beginObject()
+        .key(KHR_DRACO_MESH_COMPRESSION)
+        .beginObject()
+        .member("bufferView", dracoBufferView)
+        .member("attributes", dracoAttributes)
+        .endObject()
+        .endObject();
   }
+  writer.endObject();
 }
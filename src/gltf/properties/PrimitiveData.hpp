@@ -63,6 +63,8 @@ struct PrimitiveData {
 
   void NoteDracoBuffer(const BufferViewData& data);
 
+  void write(JsonWriter& writer) const;
+
   const int indices;
   const unsigned int material;
   const MeshMode mode;
@@ -77,4 +79,3 @@ struct PrimitiveData {
   int dracoBufferView;
 };
 
-void to_json(json& j, const PrimitiveData& d);
@@ -20,8 +20,10 @@ SkinData::SkinData(
       inverseBindMatrices(inverseBindMatricesAccessor.ix),
       skeletonRootNode(skeletonRootNode.ix) {}
 
-json SkinData::serialize() const {
-  return {{"joints", joints},
-          {"inverseBindMatrices", inverseBindMatrices},
-          {"skeleton", skeletonRootNode}};
+void SkinData::write(JsonWriter& writer) const {
+  writer.beginObject()
+      .member("joints", joints)
+      .member("inverseBindMatrices", inverseBindMatrices)
+      .member("skeleton", skeletonRootNode)
+      .endObject();
 }
@@ -16,7 +16,7 @@ struct SkinData : Holdable {
       const AccessorData& inverseBindMatricesAccessor,
       const NodeData& skeletonRootNode);
 
-  json serialize() const override;
+  void write(JsonWriter& writer) const override;
 
   const std::vector<uint32_t> joints;
   const uint32_t skeletonRootNode;
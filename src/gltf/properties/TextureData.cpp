@@ -12,8 +12,29 @@
 #include "SamplerData.hpp"
 
 TextureData::TextureData(std::string name, const SamplerData& sampler, const ImageData& source)
-    : Holdable(), name(std::move(name)), sampler(sampler.ix), source(source.ix) {}
+    : Holdable(), name(std::move(name)), sampler(sampler.ix), source(source.ix), isKtx2(false) {}
 
-json TextureData::serialize() const {
-  return {{"name", name}, {"sampler", sampler}, {"source", source}};
+TextureData::TextureData(std::string name, const SamplerData& sampler)
+    : Holdable(), name(std::move(name)), sampler(sampler.ix), source(UINT_MAX), isKtx2(false) {}
+
+void TextureData::SetSource(const ImageData& image, bool isKtx2) {
+  this->source = image.ix;
+  this->isKtx2 = isKtx2;
+}
+
+void TextureData::write(JsonWriter& writer) const {
+  writer.beginObject().member("name", name).member("sampler", sampler);
+  if (isKtx2) {
+    // there is no fallback image, so the extension is also listed in extensionsRequired
+    writer.key("extensions")
+        .beginObject()
+        .key(KHR_TEXTURE_BASISU)
+        .beginObject()
+        .member("source", source)
+        .endObject()
+        .endObject();
+  } else {
+    writer.member("source", source);
+  }
+  writer.endObject();
 }
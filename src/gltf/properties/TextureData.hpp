@@ -12,10 +12,15 @@
 
 struct TextureData : Holdable {
   TextureData(std::string name, const SamplerData& sampler, const ImageData& source);
+  // for textures whose image is only produced later, and hooked up through SetSource()
+  TextureData(std::string name, const SamplerData& sampler);
 
-  json serialize() const override;
+  void SetSource(const ImageData& image, bool isKtx2);
+
+  void write(JsonWriter& writer) const override;
 
   const std::string name;
   const uint32_t sampler;
-  const uint32_t source;
+  uint32_t source;
+  bool isKtx2; // if true, the source is referenced through KHR_texture_basisu
 };
@@ -48,6 +48,10 @@ struct Bounds {
 };
 
 typedef mathfu::Vector<uint16_t, 4> Vec4i;
+typedef mathfu::Vector<int16_t, 4> Vec4s;
+typedef mathfu::Vector<int8_t, 4> Vec4b;
+typedef mathfu::Vector<uint8_t, 4> Vec4ub;
+typedef mathfu::Vector<uint16_t, 2> Vec2i;
 typedef mathfu::Matrix<uint16_t, 4> Mat4i;
 typedef mathfu::Vector<float, 2> Vec2f;
 typedef mathfu::Vector<float, 3> Vec3f;
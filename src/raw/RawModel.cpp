@@ -9,10 +9,15 @@
 #include "RawModel.hpp"
 
 #include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <queue>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #if defined(__unix__)
@@ -20,6 +25,7 @@
 #endif
 
 #include "utils/Image_Utils.hpp"
+#include "utils/Parallel_Utils.hpp"
 #include "utils/String_Utils.hpp"
 
 size_t VertexHasher::operator()(const RawVertex& v) const {
@@ -335,6 +341,105 @@ int RawModel::AddNode(const long id, const char* name, const long parentId) {
   return (int)nodes.size() - 1;
 }
 
+// a triangle, rotated so that its smallest vertex index comes first, and its material
+struct TriangleKey {
+  int verts[3];
+  int materialIndex;
+
+  explicit TriangleKey(const RawTriangle& triangle) : materialIndex(triangle.materialIndex) {
+    const int* v = triangle.verts;
+    const int first = (v[0] < v[1]) ? (v[0] < v[2] ? 0 : 2) : (v[1] < v[2] ? 1 : 2);
+    for (int jj = 0; jj < 3; jj++) {
+      verts[jj] = v[(first + jj) % 3];
+    }
+  }
+
+  bool operator==(const TriangleKey& other) const {
+    return verts[0] == other.verts[0] && verts[1] == other.verts[1] &&
+        verts[2] == other.verts[2] && materialIndex == other.materialIndex;
+  }
+};
+
+struct TriangleKeyHasher {
+  size_t operator()(const TriangleKey& key) const {
+    size_t seed = 5381;
+    const auto hasher = std::hash<int>{};
+    for (const int vert : key.verts) {
+      seed ^= hasher(vert) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+    seed ^= hasher(key.materialIndex) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    return seed;
+  }
+};
+
+size_t RawModel::CleanTriangles() {
+  // triangles can only duplicate others of their own surface, so each surface is cleaned on its own
+  std::vector<std::vector<size_t>> surfaceTriangles(surfaces.size());
+  for (size_t triIx = 0; triIx < triangles.size(); triIx++) {
+    surfaceTriangles[triangles[triIx].surfaceIndex].push_back(triIx);
+  }
+
+  std::vector<char> keep(triangles.size(), 1);
+  std::vector<size_t> repeatedCounts(surfaces.size(), 0);
+  std::vector<size_t> zeroAreaCounts(surfaces.size(), 0);
+  std::vector<size_t> duplicateCounts(surfaces.size(), 0);
+  ParallelUtils::ForEach(surfaces.size(), [&](size_t surfaceIx) {
+    std::unordered_set<TriangleKey, TriangleKeyHasher> seen;
+    seen.reserve(surfaceTriangles[surfaceIx].size());
+    for (const size_t triIx : surfaceTriangles[surfaceIx]) {
+      const int* verts = triangles[triIx].verts;
+      if (verts[0] == verts[1] || verts[1] == verts[2] || verts[2] == verts[0]) {
+        keep[triIx] = 0;
+        repeatedCounts[surfaceIx]++;
+        continue;
+      }
+      // collinear to within float precision, relative to the triangle's size
+      const Vec3f& p0 = vertices[verts[0]].position;
+      const Vec3f& p1 = vertices[verts[1]].position;
+      const Vec3f& p2 = vertices[verts[2]].position;
+      const float longestEdge = std::max(
+          (p1 - p0).LengthSquared(),
+          std::max((p2 - p1).LengthSquared(), (p0 - p2).LengthSquared()));
+      const float tolerance = FLT_EPSILON * longestEdge;
+      if (Vec3f::CrossProduct(p1 - p0, p2 - p0).LengthSquared() <= tolerance * tolerance) {
+        keep[triIx] = 0;
+        zeroAreaCounts[surfaceIx]++;
+        continue;
+      }
+      // the same vertices in the same winding order; a back face is no duplicate
+      if (!seen.insert(TriangleKey(triangles[triIx])).second) {
+        keep[triIx] = 0;
+        duplicateCounts[surfaceIx]++;
+      }
+    }
+  });
+
+  size_t kept = 0;
+  for (size_t triIx = 0; triIx < triangles.size(); triIx++) {
+    if (keep[triIx]) {
+      triangles[kept++] = triangles[triIx];
+    }
+  }
+  const size_t removedCount = triangles.size() - kept;
+  triangles.resize(kept);
+
+  if (verboseOutput && removedCount > 0) {
+    size_t repeatedCount = 0, zeroAreaCount = 0, duplicateCount = 0;
+    for (size_t surfaceIx = 0; surfaceIx < surfaces.size(); surfaceIx++) {
+      repeatedCount += repeatedCounts[surfaceIx];
+      zeroAreaCount += zeroAreaCounts[surfaceIx];
+      duplicateCount += duplicateCounts[surfaceIx];
+    }
+    fmt::printf(
+        "Removed %zu triangles: %zu with repeated vertices, %zu with zero area, %zu duplicates.\n",
+        removedCount,
+        repeatedCount,
+        zeroAreaCount,
+        duplicateCount);
+  }
+  return removedCount;
+}
+
 void RawModel::Condense() {
   // Only keep surfaces that are referenced by one or more triangles.
   {
@@ -407,7 +512,10 @@ void RawModel::Condense() {
   }
 }
 
-void RawModel::TransformGeometry(ComputeNormalsOption normals) {
+void RawModel::TransformGeometry(
+    ComputeNormalsOption normals,
+    NormalWeightingOption weighting,
+    float smoothingAngle) {
   switch (normals) {
     case ComputeNormalsOption::NEVER:
       break;
@@ -418,7 +526,8 @@ void RawModel::TransformGeometry(ComputeNormalsOption normals) {
       // otherwise fall through
     case ComputeNormalsOption::BROKEN:
     case ComputeNormalsOption::ALWAYS:
-      size_t computedNormalsCount = this->CalculateNormals(normals == ComputeNormalsOption::BROKEN);
+      size_t computedNormalsCount = this->CalculateNormals(
+          normals == ComputeNormalsOption::BROKEN, weighting, smoothingAngle);
       vertexAttributes |= RAW_VERTEX_ATTRIBUTE_NORMAL;
 
       if (verboseOutput) {
@@ -449,6 +558,21 @@ void RawModel::TransformTextures(const std::vector<std::function<Vec2f(Vec2f)>>&
   }
 }
 
+bool RawModel::isTransparent(const RawModel& model, const RawTriangle& triangle) const {
+  const int materialIndex = triangle.materialIndex;
+  if (materialIndex < 0) {
+    return false;
+  }
+  // the material's texture indices are always our own, even in a material model
+  const int textureIndex = model.materials[materialIndex].textures[RAW_TEXTURE_USAGE_DIFFUSE];
+  if (textureIndex < 0) {
+    return model.vertices[triangle.verts[0]].color.w < 1.0f ||
+        model.vertices[triangle.verts[1]].color.w < 1.0f ||
+        model.vertices[triangle.verts[2]].color.w < 1.0f;
+  }
+  return textures[textureIndex].occlusion == RAW_TEXTURE_OCCLUSION_TRANSPARENT;
+}
+
 struct TriangleModelSortPos {
   static bool Compare(const RawTriangle& a, const RawTriangle& b) {
     if (a.materialIndex != b.materialIndex) {
@@ -487,23 +611,7 @@ void RawModel::CreateMaterialModels(
     std::vector<RawTriangle> opaqueTriangles;
     std::vector<RawTriangle> transparentTriangles;
     for (const auto& triangle : triangles) {
-      const int materialIndex = triangle.materialIndex;
-      if (materialIndex < 0) {
-        opaqueTriangles.push_back(triangle);
-        continue;
-      }
-      const int textureIndex = materials[materialIndex].textures[RAW_TEXTURE_USAGE_DIFFUSE];
-      if (textureIndex < 0) {
-        if (vertices[triangle.verts[0]].color.w < 1.0f ||
-            vertices[triangle.verts[1]].color.w < 1.0f ||
-            vertices[triangle.verts[2]].color.w < 1.0f) {
-          transparentTriangles.push_back(triangle);
-          continue;
-        }
-        opaqueTriangles.push_back(triangle);
-        continue;
-      }
-      if (textures[textureIndex].occlusion == RAW_TEXTURE_OCCLUSION_TRANSPARENT) {
+      if (isTransparent(*this, triangle)) {
         transparentTriangles.push_back(triangle);
       } else {
         opaqueTriangles.push_back(triangle);
@@ -658,72 +766,1041 @@ int RawModel::GetSurfaceById(const long surfaceId) const {
   return -1;
 }
 
-Vec3f RawModel::getFaceNormal(int verts[3]) const {
-  const float l0 = (vertices[verts[1]].position - vertices[verts[0]].position).LengthSquared();
-  const float l1 = (vertices[verts[2]].position - vertices[verts[1]].position).LengthSquared();
-  const float l2 = (vertices[verts[0]].position - vertices[verts[2]].position).LengthSquared();
-  const int index = (l0 > l1) ? (l0 > l2 ? 2 : 1) : (l1 > l2 ? 0 : 1);
+// parallel loops over many cheap items hand out chunks of this many at a time
+static const size_t NORMALS_CHUNK_SIZE = 4096;
+
+template <typename Fn>
+static void forEachChunked(size_t count, const Fn& fn) {
+  ParallelUtils::ForEach((count + NORMALS_CHUNK_SIZE - 1) / NORMALS_CHUNK_SIZE, [&](size_t chunk) {
+    const size_t end = std::min(count, (chunk + 1) * NORMALS_CHUNK_SIZE);
+    for (size_t ix = chunk * NORMALS_CHUNK_SIZE; ix < end; ix++) {
+      fn(ix);
+    }
+  });
+}
+
+// a position on a given surface
+typedef std::pair<int, Vec3f> SurfacePosition;
 
-  const Vec3f e0 = vertices[verts[(index + 1) % 3]].position - vertices[verts[index]].position;
-  const Vec3f e1 = vertices[verts[(index + 2) % 3]].position - vertices[verts[index]].position;
-  if (e0.LengthSquared() < FLT_MIN || e1.LengthSquared() < FLT_MIN) {
-    return Vec3f{0.0f};
+struct SurfacePositionHasher {
+  size_t operator()(const SurfacePosition& key) const {
+    size_t seed = 5381;
+    const auto hasher = std::hash<float>{};
+    seed ^= std::hash<int>{}(key.first) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    for (int ii = 0; ii < 3; ii++) {
+      seed ^= hasher(key.second[ii]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+    return seed;
   }
-  auto result = Vec3f::CrossProduct(e0, e1);
-  auto resultLengthSquared = result.LengthSquared();
-  if (resultLengthSquared < FLT_MIN) {
-    return Vec3f{0.0f};
+};
+
+size_t RawModel::CalculateNormals(
+    bool onlyBroken,
+    NormalWeightingOption weighting,
+    float smoothingAngle) {
+  const size_t vertexCount = vertices.size();
+  const size_t cornerCount = 3 * triangles.size();
+
+  // the vertices that get a new normal
+  std::vector<char> broken(vertexCount);
+  forEachChunked(vertexCount, [&](size_t vertIx) {
+    broken[vertIx] = !onlyBroken || vertices[vertIx].normal.LengthSquared() < FLT_MIN;
+  });
+
+  // each triangle's unit normal, and how much it counts at each of its corners
+  std::vector<Vec3f> faceNormals(triangles.size());
+  std::vector<float> cornerWeights(cornerCount);
+  forEachChunked(triangles.size(), [&](size_t triIx) {
+    const int* verts = triangles[triIx].verts;
+    const Vec3f cross = Vec3f::CrossProduct(
+        vertices[verts[1]].position - vertices[verts[0]].position,
+        vertices[verts[2]].position - vertices[verts[0]].position);
+    const float crossLength = cross.Length();
+    faceNormals[triIx] = crossLength >= FLT_MIN ? cross / crossLength : Vec3f{0.0f};
+    for (int jj = 0; jj < 3; jj++) {
+      float& weight = cornerWeights[3 * triIx + jj];
+      if (crossLength < FLT_MIN) {
+        weight = 0.0f;
+      } else if (weighting == NormalWeightingOption::AREA) {
+        weight = crossLength / 2.0f;
+      } else if (weighting == NormalWeightingOption::ANGLE) {
+        const Vec3f& corner = vertices[verts[jj]].position;
+        const Vec3f e0 = vertices[verts[(jj + 1) % 3]].position - corner;
+        const Vec3f e1 = vertices[verts[(jj + 2) % 3]].position - corner;
+        const float lengths = e0.Length() * e1.Length();
+        weight = lengths < FLT_MIN
+            ? 0.0f
+            : std::acos(std::max(-1.0f, std::min(1.0f, Vec3f::DotProduct(e0, e1) / lengths)));
+      } else {
+        weight = 1.0f;
+      }
+    }
+  });
+
+  // faces of a surface smooth each other's normals wherever they meet at a position, whether or
+  // not they share vertices there, but never those of another surface that merely touches; group
+  // the corners by surface and position, counting-sort style
+  std::vector<int> groupOfCorner(cornerCount);
+  int groupCount = 0;
+  {
+    std::unordered_map<SurfacePosition, int, SurfacePositionHasher> groupOfPosition;
+    // most vertices are used by a single surface; remember the first one's group to skip the map
+    std::vector<std::pair<int, int>> firstGroupOfVertex(vertexCount, std::make_pair(-1, -1));
+    for (size_t cornerIx = 0; cornerIx < cornerCount; cornerIx++) {
+      const RawTriangle& triangle = triangles[cornerIx / 3];
+      const int vertIx = triangle.verts[cornerIx % 3];
+      std::pair<int, int>& firstGroup = firstGroupOfVertex[vertIx];
+      if (firstGroup.first == triangle.surfaceIndex) {
+        groupOfCorner[cornerIx] = firstGroup.second;
+        continue;
+      }
+      const SurfacePosition key(triangle.surfaceIndex, vertices[vertIx].position);
+      auto inserted = groupOfPosition.emplace(key, groupCount);
+      groupCount += inserted.second ? 1 : 0;
+      groupOfCorner[cornerIx] = inserted.first->second;
+      if (firstGroup.first < 0) {
+        firstGroup = std::make_pair(triangle.surfaceIndex, inserted.first->second);
+      }
+    }
   }
-  float edgeDot = std::max(-1.0f, std::min(1.0f, Vec3f::DotProduct(e0, e1)));
-  float angle = acos(edgeDot);
-  float area = resultLengthSquared / 2.0f;
-  return result.Normalized() * angle * area;
-}
+  std::vector<size_t> groupStarts(groupCount + 1, 0);
+  for (size_t cornerIx = 0; cornerIx < cornerCount; cornerIx++) {
+    groupStarts[groupOfCorner[cornerIx] + 1]++;
+  }
+  for (int groupIx = 0; groupIx < groupCount; groupIx++) {
+    groupStarts[groupIx + 1] += groupStarts[groupIx];
+  }
+  std::vector<size_t> groupCorners(cornerCount);
+  {
+    std::vector<size_t> groupEnds(groupStarts.begin(), groupStarts.end() - 1);
+    for (size_t cornerIx = 0; cornerIx < cornerCount; cornerIx++) {
+      groupCorners[groupEnds[groupOfCorner[cornerIx]]++] = cornerIx;
+    }
+  }
+
+  // sum up the normal at each corner that needs one, a position at a time; below 180 degrees, only
+  // faces within the smoothing angle of the corner's own face count
+  const bool smoothAll = smoothingAngle >= 180.0f;
+  const float smoothingCos = std::cos(smoothingAngle * (float)M_PI / 180.0f);
+  std::vector<Vec3f> cornerNormals(cornerCount, Vec3f{0.0f});
+  ParallelUtils::ForEach(groupCount, [&](size_t groupIx) {
+    const size_t* begin = groupCorners.data() + groupStarts[groupIx];
+    const size_t* end = groupCorners.data() + groupStarts[groupIx + 1];
+    Vec3f smoothNormal{0.0f};
+    if (smoothAll) {
+      for (const size_t* other = begin; other != end; other++) {
+        smoothNormal += faceNormals[*other / 3] * cornerWeights[*other];
+      }
+    }
+    for (const size_t* corner = begin; corner != end; corner++) {
+      if (!broken[triangles[*corner / 3].verts[*corner % 3]]) {
+        continue;
+      }
+      if (smoothAll) {
+        cornerNormals[*corner] = smoothNormal;
+        continue;
+      }
+      const Vec3f& faceNormal = faceNormals[*corner / 3];
+      for (const size_t* other = begin; other != end; other++) {
+        const Vec3f& otherNormal = faceNormals[*other / 3];
+        if (Vec3f::DotProduct(faceNormal, otherNormal) >= smoothingCos) {
+          cornerNormals[*corner] += otherNormal * cornerWeights[*other];
+        }
+      }
+    }
+  });
 
-size_t RawModel::CalculateNormals(bool onlyBroken) {
+  // vertices without a face to speak of point away from the middle of the model
   Vec3f averagePos = Vec3f{0.0f};
-  std::set<int> brokenVerts;
-  for (int vertIx = 0; vertIx < vertices.size(); vertIx++) {
-    RawVertex& vertex = vertices[vertIx];
-    averagePos += (vertex.position / (float)vertices.size());
-    if (onlyBroken && (vertex.normal.LengthSquared() >= FLT_MIN)) {
+  for (const RawVertex& vertex : vertices) {
+    averagePos += (vertex.position / (float)vertexCount);
+  }
+  auto normalize = [&averagePos](Vec3f normal, const Vec3f& position) {
+    if (normal.LengthSquared() < FLT_MIN) {
+      normal = position - averagePos;
+      if (normal.LengthSquared() < FLT_MIN) {
+        return Vec3f{0.0f, 1.0f, 0.0f};
+      }
+    }
+    return normal.Normalized();
+  };
+
+  // a vertex whose corners end up with different normals (across a hard edge) is split in as many
+  std::vector<char> assigned(vertexCount, 0);
+  std::unordered_map<int, std::vector<int>> splitsOfVertex;
+  size_t computedCount = 0;
+  for (size_t cornerIx = 0; cornerIx < cornerCount; cornerIx++) {
+    int& vertIx = triangles[cornerIx / 3].verts[cornerIx % 3];
+    if (!broken[vertIx]) {
       continue;
     }
-    vertex.normal = Vec3f{0.0f};
-    if (onlyBroken) {
-      brokenVerts.emplace(vertIx);
+    const Vec3f normal = normalize(cornerNormals[cornerIx], vertices[vertIx].position);
+    if (!assigned[vertIx]) {
+      vertices[vertIx].normal = normal;
+      assigned[vertIx] = 1;
+      computedCount++;
+    } else if (vertices[vertIx].normal != normal) {
+      std::vector<int>& splits = splitsOfVertex[vertIx];
+      auto split = std::find_if(splits.begin(), splits.end(), [&](int splitIx) {
+        return vertices[splitIx].normal == normal;
+      });
+      if (split != splits.end()) {
+        vertIx = *split;
+      } else {
+        RawVertex vertex = vertices[vertIx];
+        vertex.normal = normal;
+        splits.push_back((int)vertices.size());
+        vertIx = (int)vertices.size();
+        vertices.push_back(std::move(vertex));
+        computedCount++;
+      }
+    }
+  }
+  for (size_t vertIx = 0; vertIx < vertexCount; vertIx++) {
+    if (broken[vertIx] && !assigned[vertIx]) {
+      vertices[vertIx].normal = normalize(Vec3f{0.0f}, vertices[vertIx].position);
+      computedCount++;
+    }
+  }
+
+  // the normals have changed under the hash's keys
+  vertexHash.clear();
+  for (size_t i = 0; i < vertices.size(); i++) {
+    vertexHash.emplace(vertices[i], (int)i);
+  }
+  return computedCount;
+}
+
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" scores each vertex by how recently it was
+// used and by how many triangles still need it, and greedily emits the best scoring triangle.
+static const int VERTEX_CACHE_SIZE = 32;
+
+static float vertexCacheScore(int cachePosition, int remainingTriangles) {
+  if (remainingTriangles == 0) {
+    // no triangle needs this vertex anymore
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // it was used by the last triangle; deliberately not the best choice, to avoid strips
+      score = 0.75f;
+    } else {
+      const float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+    }
+  }
+  // favour vertices with few triangles left, so as not to leave lone triangles behind
+  return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+}
+
+static void optimizeVertexCache(RawTriangle* triangles, size_t triangleCount, int vertexCount) {
+  if (triangleCount < 2) {
+    return;
+  }
+
+  // each vertex's triangles, with those not yet emitted first
+  std::vector<int> adjacencyStart(vertexCount + 1, 0);
+  for (size_t triIx = 0; triIx < triangleCount; triIx++) {
+    for (int j = 0; j < 3; j++) {
+      adjacencyStart[triangles[triIx].verts[j] + 1]++;
+    }
+  }
+  for (int vertIx = 0; vertIx < vertexCount; vertIx++) {
+    adjacencyStart[vertIx + 1] += adjacencyStart[vertIx];
+  }
+  std::vector<int> remaining(vertexCount, 0);
+  std::vector<int> adjacency(triangleCount * 3);
+  for (size_t triIx = 0; triIx < triangleCount; triIx++) {
+    for (int j = 0; j < 3; j++) {
+      const int vertIx = triangles[triIx].verts[j];
+      adjacency[adjacencyStart[vertIx] + remaining[vertIx]++] = static_cast<int>(triIx);
     }
   }
 
+  std::vector<float> vertexScores(vertexCount);
+  for (int vertIx = 0; vertIx < vertexCount; vertIx++) {
+    vertexScores[vertIx] = vertexCacheScore(-1, remaining[vertIx]);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  std::vector<bool> emitted(triangleCount, false);
+  for (size_t triIx = 0; triIx < triangleCount; triIx++) {
+    const int* verts = triangles[triIx].verts;
+    triangleScores[triIx] =
+        vertexScores[verts[0]] + vertexScores[verts[1]] + vertexScores[verts[2]];
+  }
+
+  std::vector<RawTriangle> result;
+  result.reserve(triangleCount);
+  std::vector<int> cache, nextCache;
+  size_t nextUnemitted = 0;
+  int bestTriangle = -1;
+  while (result.size() < triangleCount) {
+    if (bestTriangle < 0) {
+      // nothing in the cache leads anywhere: start over from the first triangle left
+      while (emitted[nextUnemitted]) {
+        nextUnemitted++;
+      }
+      bestTriangle = static_cast<int>(nextUnemitted);
+    }
+    const RawTriangle& triangle = triangles[bestTriangle];
+    result.push_back(triangle);
+    emitted[bestTriangle] = true;
+
+    // the triangle's vertices go to the front of the cache, pushing the others back
+    nextCache.clear();
+    for (int j = 0; j < 3; j++) {
+      const int vertIx = triangle.verts[j];
+      if (std::find(nextCache.begin(), nextCache.end(), vertIx) == nextCache.end()) {
+        nextCache.push_back(vertIx);
+      }
+      int* begin = &adjacency[adjacencyStart[vertIx]];
+      int* end = begin + remaining[vertIx];
+      std::swap(*std::find(begin, end, bestTriangle), *(end - 1));
+      remaining[vertIx]--;
+    }
+    for (const int vertIx : cache) {
+      if (vertIx != triangle.verts[0] && vertIx != triangle.verts[1] &&
+          vertIx != triangle.verts[2]) {
+        nextCache.push_back(vertIx);
+      }
+    }
+    std::swap(cache, nextCache);
+
+    // rescore every vertex whose cache position changed, and with it all its remaining triangles
+    bestTriangle = -1;
+    float bestScore = -1.0f;
+    for (size_t cacheIx = 0; cacheIx < cache.size(); cacheIx++) {
+      const int vertIx = cache[cacheIx];
+      const int position = cacheIx < VERTEX_CACHE_SIZE ? static_cast<int>(cacheIx) : -1;
+      const float delta = vertexCacheScore(position, remaining[vertIx]) - vertexScores[vertIx];
+      vertexScores[vertIx] += delta;
+      for (int adjIx = 0; adjIx < remaining[vertIx]; adjIx++) {
+        const int triIx = adjacency[adjacencyStart[vertIx] + adjIx];
+        triangleScores[triIx] += delta;
+        if (triangleScores[triIx] > bestScore) {
+          bestScore = triangleScores[triIx];
+          bestTriangle = triIx;
+        }
+      }
+    }
+    if (cache.size() > VERTEX_CACHE_SIZE) {
+      cache.resize(VERTEX_CACHE_SIZE);
+    }
+  }
+  std::copy(result.begin(), result.end(), triangles);
+}
+
+// the average number of vertices per triangle a FIFO post-transform cache of typical size misses
+static float averageCacheMissRatio(const std::vector<RawTriangle>& triangles) {
+  const size_t FIFO_SIZE = 16;
+  std::vector<int> fifo;
+  size_t head = 0, misses = 0;
+  for (const RawTriangle& triangle : triangles) {
+    for (int j = 0; j < 3; j++) {
+      if (std::find(fifo.begin(), fifo.end(), triangle.verts[j]) != fifo.end()) {
+        continue;
+      }
+      misses++;
+      if (fifo.size() < FIFO_SIZE) {
+        fifo.push_back(triangle.verts[j]);
+      } else {
+        fifo[head] = triangle.verts[j];
+        head = (head + 1) % FIFO_SIZE;
+      }
+    }
+  }
+  return triangles.empty() ? 0.0f : static_cast<float>(misses) / triangles.size();
+}
+
+void RawModel::OptimizeVertexFetch() {
+  std::vector<int> remap(vertices.size(), -1);
+  std::vector<RawVertex> newVertices;
+  newVertices.reserve(vertices.size());
   for (auto& triangle : triangles) {
-    bool relevant = false;
-    for (int vertIx : triangle.verts) {
-      relevant |= (brokenVerts.count(vertIx) > 0);
+    for (int j = 0; j < 3; j++) {
+      int& vertIx = triangle.verts[j];
+      if (remap[vertIx] < 0) {
+        remap[vertIx] = (int)newVertices.size();
+        newVertices.push_back(std::move(vertices[vertIx]));
+      }
+      vertIx = remap[vertIx];
     }
-    if (!relevant) {
-      continue;
+  }
+  vertices.swap(newVertices);
+
+  vertexHash.clear();
+  for (size_t i = 0; i < vertices.size(); i++) {
+    vertexHash.emplace(vertices[i], (int)i);
+  }
+}
+
+// how near-identical two vertices must be for WeldMaterialModels to weld them
+struct WeldTolerance {
+  float position;
+  // the minimum cosine of the angle between normals, tangents or binormals
+  float directionCos;
+  // the distance between two unit vectors at the maximum angle, for blend shape deltas
+  float directionChord;
+  float uv;
+};
+
+static bool directionsWeldable(const Vec3f& a, const Vec3f& b, const WeldTolerance& tolerance) {
+  const float lengths = a.Length() * b.Length();
+  if (lengths == 0) {
+    return a == b;
+  }
+  return Vec3f::DotProduct(a, b) >= tolerance.directionCos * lengths;
+}
+
+// whether two vertices of a model with the given attributes are near enough identical to weld
+static bool verticesWeldable(
+    const RawVertex& a,
+    const RawVertex& b,
+    int vertexAttributes,
+    const WeldTolerance& tolerance) {
+  // never across UV polarity or blend shape setups, nor between differently skinned vertices
+  if (a.polarityUv0 != b.polarityUv0 || a.blendSurfaceIx != b.blendSurfaceIx ||
+      a.jointIndices != b.jointIndices || a.jointWeights != b.jointWeights ||
+      a.blends.size() != b.blends.size()) {
+    return false;
+  }
+  const float position2 = tolerance.position * tolerance.position;
+  if ((a.position - b.position).LengthSquared() > position2) {
+    return false;
+  }
+  if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_NORMAL) &&
+      !directionsWeldable(a.normal, b.normal, tolerance)) {
+    return false;
+  }
+  if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_TANGENT) &&
+      ((a.tangent.w < 0) != (b.tangent.w < 0) ||
+       !directionsWeldable(a.tangent.xyz(), b.tangent.xyz(), tolerance))) {
+    return false;
+  }
+  if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_BINORMAL) &&
+      !directionsWeldable(a.binormal, b.binormal, tolerance)) {
+    return false;
+  }
+  if (vertexAttributes & RAW_VERTEX_ATTRIBUTE_COLOR) {
+    // colors within half an 8-bit step of each other look the same
+    for (int ii = 0; ii < 4; ii++) {
+      if (std::abs(a.color[ii] - b.color[ii]) > 0.5f / 255) {
+        return false;
+      }
+    }
+  }
+  const float uv2 = tolerance.uv * tolerance.uv;
+  if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) && (a.uv0 - b.uv0).LengthSquared() > uv2) {
+    return false;
+  }
+  if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV1) && (a.uv1 - b.uv1).LengthSquared() > uv2) {
+    return false;
+  }
+  const float chord2 = tolerance.directionChord * tolerance.directionChord;
+  for (size_t ii = 0; ii < a.blends.size(); ii++) {
+    const RawBlendVertex& blendA = a.blends[ii];
+    const RawBlendVertex& blendB = b.blends[ii];
+    if ((blendA.position - blendB.position).LengthSquared() > position2 ||
+        (blendA.normal - blendB.normal).LengthSquared() > chord2 ||
+        (blendA.tangent.xyz() - blendB.tangent.xyz()).LengthSquared() > chord2) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Weld each vertex to the first vertex before it that it's near enough identical to, if any. A grid
+ * of cells no smaller than the position tolerance is hashed, so only the 27 cells around a vertex
+ * need searching. Returns, for each vertex, the vertex it's welded to, or itself.
+ */
+static std::vector<int> findWelds(
+    const std::vector<RawVertex>& vertices,
+    int vertexAttributes,
+    const WeldTolerance& tolerance) {
+  Bounds<float, 3> bounds;
+  for (const RawVertex& vertex : vertices) {
+    bounds.AddPoint(vertex.position);
+  }
+  // 21 bits per axis go into a cell's key
+  const float diagonal = (bounds.max - bounds.min).Length();
+  const float cellSize = std::max(
+      std::max(tolerance.position, diagonal / (1 << 20)), std::numeric_limits<float>::min());
+  auto cellOf = [&](const Vec3f& position, int axis, int offset) -> uint64_t {
+    const float cell = std::floor((position[axis] - bounds.min[axis]) / cellSize);
+    return (uint64_t)std::min(std::max(cell + offset, 0.0f), (float)((1 << 21) - 1));
+  };
+
+  std::unordered_map<uint64_t, std::vector<int>> grid;
+  std::vector<int> welds(vertices.size());
+  for (int vv = 0; vv < (int)vertices.size(); vv++) {
+    const RawVertex& vertex = vertices[vv];
+    // the earliest match wins, which makes this independent of hash iteration order
+    int weld = vv;
+    for (int dx = -1; dx <= 1; dx++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dz = -1; dz <= 1; dz++) {
+          const uint64_t key = cellOf(vertex.position, 0, dx) << 42 |
+              cellOf(vertex.position, 1, dy) << 21 | cellOf(vertex.position, 2, dz);
+          auto cellIter = grid.find(key);
+          if (cellIter == grid.end()) {
+            continue;
+          }
+          for (const int other : cellIter->second) {
+            if (other < weld &&
+                verticesWeldable(vertices[other], vertex, vertexAttributes, tolerance)) {
+              weld = other;
+            }
+          }
+        }
+      }
+    }
+    welds[vv] = weld;
+    if (weld == vv) {
+      const uint64_t key = cellOf(vertex.position, 0, 0) << 42 |
+          cellOf(vertex.position, 1, 0) << 21 | cellOf(vertex.position, 2, 0);
+      grid[key].push_back(vv);
+    }
+  }
+  return welds;
+}
+
+void RawModel::WeldMaterialModels(
+    std::vector<RawModel>& materialModels,
+    float positionTolerance,
+    float normalAngle,
+    float uvTolerance) const {
+  const float halfAngle = 0.5f * normalAngle * (float)M_PI / 180.0f;
+  std::vector<size_t> verticesBefore(materialModels.size());
+  std::vector<size_t> trianglesBefore(materialModels.size());
+
+  // the tolerance is relative to the whole mesh, so all of its primitives weld alike
+  std::map<long, Bounds<float, 3>> boundsBySurfaceId;
+  for (const RawModel& model : materialModels) {
+    Bounds<float, 3>& bounds = boundsBySurfaceId[model.surfaces[0].id];
+    for (const RawVertex& vertex : model.vertices) {
+      bounds.AddPoint(vertex.position);
+    }
+  }
+
+  ParallelUtils::ForEach(materialModels.size(), [&](size_t modelIx) {
+    RawModel& model = materialModels[modelIx];
+    verticesBefore[modelIx] = model.vertices.size();
+    trianglesBefore[modelIx] = model.triangles.size();
+
+    const Bounds<float, 3>& bounds = boundsBySurfaceId.at(model.surfaces[0].id);
+    WeldTolerance tolerance;
+    tolerance.position = positionTolerance * (bounds.max - bounds.min).Length();
+    tolerance.directionCos = std::cos(2 * halfAngle);
+    tolerance.directionChord = 2 * std::sin(halfAngle);
+    tolerance.uv = uvTolerance;
+    const std::vector<int> welds = findWelds(model.vertices, model.vertexAttributes, tolerance);
+
+    // triangles whose corners were welded together are left with no area
+    size_t kept = 0;
+    for (RawTriangle triangle : model.triangles) {
+      for (int jj = 0; jj < 3; jj++) {
+        triangle.verts[jj] = welds[triangle.verts[jj]];
+      }
+      if (triangle.verts[0] != triangle.verts[1] && triangle.verts[1] != triangle.verts[2] &&
+          triangle.verts[2] != triangle.verts[0]) {
+        model.triangles[kept++] = triangle;
+      }
+    }
+    model.triangles.resize(kept);
+
+    // keep the vertices that a surviving triangle still uses, in their original order
+    std::vector<int> remap(model.vertices.size(), -1);
+    for (const RawTriangle& triangle : model.triangles) {
+      for (int jj = 0; jj < 3; jj++) {
+        remap[triangle.verts[jj]] = 0;
+      }
+    }
+    std::vector<RawVertex> newVertices;
+    for (size_t vv = 0; vv < model.vertices.size(); vv++) {
+      if (remap[vv] == 0) {
+        remap[vv] = (int)newVertices.size();
+        newVertices.push_back(std::move(model.vertices[vv]));
+      }
+    }
+    for (RawTriangle& triangle : model.triangles) {
+      for (int jj = 0; jj < 3; jj++) {
+        triangle.verts[jj] = remap[triangle.verts[jj]];
+      }
     }
-    Vec3f faceNormal = this->getFaceNormal(triangle.verts);
-    for (int vertIx : triangle.verts) {
-      if (!onlyBroken || brokenVerts.count(vertIx) > 0) {
-        vertices[vertIx].normal += faceNormal;
+    model.vertices.swap(newVertices);
+
+    model.vertexHash.clear();
+    for (size_t i = 0; i < model.vertices.size(); i++) {
+      model.vertexHash.emplace(model.vertices[i], (int)i);
+    }
+
+    RawSurface& surface = model.surfaces[0];
+    surface.bounds.Clear();
+    for (const RawVertex& vertex : model.vertices) {
+      surface.bounds.AddPoint(vertex.position);
+    }
+  });
+
+  if (verboseOutput) {
+    for (size_t modelIx = 0; modelIx < materialModels.size(); modelIx++) {
+      const RawModel& model = materialModels[modelIx];
+      if (model.vertices.size() < verticesBefore[modelIx]) {
+        fmt::printf(
+            "Welding: primitive %zu has %zu vertices, down from %zu, and lost %zu triangles\n",
+            modelIx,
+            model.vertices.size(),
+            verticesBefore[modelIx],
+            trianglesBefore[modelIx] - model.triangles.size());
+      }
+    }
+  }
+
+  // a primitive whose triangles all collapsed is no primitive at all
+  materialModels.erase(
+      std::remove_if(
+          materialModels.begin(),
+          materialModels.end(),
+          [](const RawModel& model) { return model.triangles.empty(); }),
+      materialModels.end());
+}
+
+void RawModel::OptimizeMaterialModels(
+    std::vector<RawModel>& materialModels,
+    bool vertexCache,
+    bool vertexFetch) const {
+  std::vector<float> missRatiosBefore(materialModels.size());
+  std::vector<float> missRatiosAfter(materialModels.size());
+  ParallelUtils::ForEach(materialModels.size(), [&](size_t modelIx) {
+    RawModel& model = materialModels[modelIx];
+    std::vector<RawTriangle>& modelTriangles = model.triangles;
+    if (vertexCache) {
+      if (verboseOutput) {
+        missRatiosBefore[modelIx] = averageCacheMissRatio(modelTriangles);
+      }
+      // only reorder runs of opaque triangles; transparent ones are sorted back to front
+      size_t runStart = 0;
+      while (runStart < modelTriangles.size()) {
+        const bool transparent = isTransparent(model, modelTriangles[runStart]);
+        size_t runEnd = runStart + 1;
+        while (runEnd < modelTriangles.size() &&
+               isTransparent(model, modelTriangles[runEnd]) == transparent) {
+          runEnd++;
+        }
+        if (!transparent) {
+          optimizeVertexCache(
+              &modelTriangles[runStart], runEnd - runStart, model.GetVertexCount());
+        }
+        runStart = runEnd;
+      }
+      if (verboseOutput) {
+        missRatiosAfter[modelIx] = averageCacheMissRatio(modelTriangles);
+      }
+    }
+    if (vertexFetch) {
+      model.OptimizeVertexFetch();
+    }
+  });
+
+  if (verboseOutput && vertexCache) {
+    for (size_t modelIx = 0; modelIx < materialModels.size(); modelIx++) {
+      fmt::printf(
+          "Vertex cache: primitive %zu misses %.3f vertices per triangle, down from %.3f\n",
+          modelIx,
+          missRatiosAfter[modelIx],
+          missRatiosBefore[modelIx]);
+    }
+  }
+}
+
+// a symmetric 4x4 error quadric, as in Garland & Heckbert's "Surface Simplification Using Quadric
+// Error Metrics": the sum of the squared distances of a point to a set of (area-weighted) planes
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0;
+  double c = 0;
+
+  // the plane of all points p for which dot(normal, p) + distance is zero
+  void AddPlane(const Vec3f& normal, float distance, float weight) {
+    const double x = normal.x, y = normal.y, z = normal.z, d = distance;
+    a00 += weight * x * x;
+    a01 += weight * x * y;
+    a02 += weight * x * z;
+    a11 += weight * y * y;
+    a12 += weight * y * z;
+    a22 += weight * z * z;
+    b0 += weight * x * d;
+    b1 += weight * y * d;
+    b2 += weight * z * d;
+    c += weight * d * d;
+  }
+
+  void Add(const Quadric& other) {
+    a00 += other.a00;
+    a01 += other.a01;
+    a02 += other.a02;
+    a11 += other.a11;
+    a12 += other.a12;
+    a22 += other.a22;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+  }
+
+  double Error(const Vec3f& p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + a11 * y * y +
+        2 * a12 * y * z + a22 * z * z + 2 * (b0 * x + b1 * y + b2 * z) + c;
+    return std::max(0.0, error);
+  }
+};
+
+// how differently two vertices are skinned, from 0 (identically) to 1 (to disjoint joints)
+static float skinDistance(const RawVertex& a, const RawVertex& b) {
+  float distance = 0;
+  for (int ii = 0; ii < 4; ii++) {
+    float weightInB = 0;
+    float weightInA = 0;
+    for (int jj = 0; jj < 4; jj++) {
+      if (b.jointIndices[jj] == a.jointIndices[ii]) {
+        weightInB += b.jointWeights[jj];
+      }
+      if (a.jointIndices[jj] == b.jointIndices[ii]) {
+        weightInA += a.jointWeights[jj];
       }
     }
+    // each joint is counted from both sides, hence the halves
+    distance += 0.5f * (std::max(0.0f, a.jointWeights[ii] - weightInB) +
+                        std::max(0.0f, b.jointWeights[ii] - weightInA));
   }
+  return std::min(1.0f, distance);
+}
 
-  for (int vertIx = 0; vertIx < vertices.size(); vertIx++) {
-    if (onlyBroken && brokenVerts.count(vertIx) == 0) {
+/**
+ * Simplify a triangle list by quadric edge collapse, until no more than targetCount triangles are
+ * left, or no collapse is possible. Each collapse moves one vertex onto a neighbour, so all that
+ * survive are original vertices, with their attributes and skin weights intact. Only vertices that
+ * are alone at their position and surrounded by triangles ever move: those on UV or normal seams,
+ * on open borders (where one material meets another, too) and on non-manifold edges stay put,
+ * keeping seams and borders intact. Collapses that would fold over a triangle, in space or in UV
+ * space, or make the mesh non-manifold, are not made; and moving between differently skinned
+ * vertices costs extra. The surviving triangles keep their order.
+ */
+static void simplifyTriangles(
+    std::vector<RawTriangle>& triangles,
+    const std::vector<RawVertex>& vertices,
+    int vertexAttributes,
+    size_t targetCount) {
+  const int vertexCount = (int)vertices.size();
+  const int triangleCount = (int)triangles.size();
+  if (triangleCount <= (int)targetCount) {
+    return;
+  }
+
+  // vertices that share a position are welded into one, for the purposes of topology
+  std::vector<int> weld(vertexCount);
+  std::vector<int> wedgeCount(vertexCount, 0);
+  {
+    std::vector<int> order(vertexCount);
+    for (int ii = 0; ii < vertexCount; ii++) {
+      order[ii] = ii;
+    }
+    auto positionLess = [&vertices](int a, int b) {
+      const Vec3f& pa = vertices[a].position;
+      const Vec3f& pb = vertices[b].position;
+      return pa.x != pb.x ? pa.x < pb.x : (pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z);
+    };
+    std::sort(order.begin(), order.end(), positionLess);
+    for (int ii = 0; ii < vertexCount; ii++) {
+      const bool same =
+          ii > 0 && vertices[order[ii]].position == vertices[order[ii - 1]].position;
+      weld[order[ii]] = same ? weld[order[ii - 1]] : order[ii];
+      wedgeCount[weld[order[ii]]]++;
+    }
+  }
+
+  // each welded position's triangles (some of which go stale), planes, and surrounding area
+  std::vector<std::vector<int>> adjacency(vertexCount);
+  std::vector<Quadric> quadrics(vertexCount);
+  std::vector<float> areas(vertexCount, 0.0f);
+  std::unordered_map<uint64_t, int> edgeUses;
+  auto edgeKey = [](int a, int b) {
+    return (uint64_t)std::min(a, b) << 32 | (uint32_t)std::max(a, b);
+  };
+  for (int tt = 0; tt < triangleCount; tt++) {
+    const int* verts = triangles[tt].verts;
+    const Vec3f& p0 = vertices[verts[0]].position;
+    const Vec3f cross = Vec3f::CrossProduct(
+        vertices[verts[1]].position - p0, vertices[verts[2]].position - p0);
+    const float area = 0.5f * cross.Length();
+    const Vec3f normal = area > 0 ? cross / (2 * area) : cross;
+    for (int jj = 0; jj < 3; jj++) {
+      const int welded = weld[verts[jj]];
+      adjacency[welded].push_back(tt);
+      if (area > 0) {
+        quadrics[welded].AddPlane(normal, -Vec3f::DotProduct(normal, p0), area);
+        areas[welded] += area;
+      }
+      const int next = weld[verts[(jj + 1) % 3]];
+      if (welded != next) {
+        edgeUses[edgeKey(welded, next)]++;
+      }
+    }
+  }
+
+  // only a vertex alone at its position, with exactly two triangles on each of its edges, may move
+  std::vector<bool> locked(vertexCount, false);
+  for (int vv = 0; vv < vertexCount; vv++) {
+    locked[vv] = weld[vv] != vv || wedgeCount[vv] > 1;
+  }
+  for (const auto& edge : edgeUses) {
+    if (edge.second != 2) {
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffff] = true;
+    }
+  }
+
+  std::vector<bool> alive(triangleCount, true);
+  auto contains = [&](int tt, int welded) {
+    const int* verts = triangles[tt].verts;
+    return weld[verts[0]] == welded || weld[verts[1]] == welded || weld[verts[2]] == welded;
+  };
+  // the other positions around a welded one
+  auto neighbours = [&](int welded) -> std::vector<int> {
+    std::vector<int> result;
+    for (const int tt : adjacency[welded]) {
+      if (alive[tt]) {
+        for (int jj = 0; jj < 3; jj++) {
+          const int other = weld[triangles[tt].verts[jj]];
+          if (other != welded) {
+            result.push_back(other);
+          }
+        }
+      }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  };
+
+  const bool checkUvs = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0;
+  const bool checkSkin = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) != 0;
+  // the cost of moving vertex u, with the given neighbours, onto vertex v; negative if not allowed
+  auto collapseCost = [&](int u, const std::vector<int>& around, int v) -> double {
+    const int target = weld[v];
+    size_t sharedTriangles = 0;
+    for (const int tt : adjacency[u]) {
+      if (!alive[tt]) {
+        continue;
+      }
+      const int* verts = triangles[tt].verts;
+      if (contains(tt, target)) {
+        // all the triangles along the edge must agree on which vertex is at the other end
+        if (verts[0] != v && verts[1] != v && verts[2] != v) {
+          return -1;
+        }
+        sharedTriangles++;
+        continue;
+      }
+      Vec3f before[3], after[3];
+      Vec2f uvBefore[3], uvAfter[3];
+      for (int jj = 0; jj < 3; jj++) {
+        const int moved = verts[jj] == u ? v : verts[jj];
+        before[jj] = vertices[verts[jj]].position;
+        after[jj] = vertices[moved].position;
+        uvBefore[jj] = vertices[verts[jj]].uv0;
+        uvAfter[jj] = vertices[moved].uv0;
+      }
+      const Vec3f normalBefore =
+          Vec3f::CrossProduct(before[1] - before[0], before[2] - before[0]);
+      const Vec3f normalAfter = Vec3f::CrossProduct(after[1] - after[0], after[2] - after[0]);
+      const float lengths = normalBefore.Length() * normalAfter.Length();
+      if (lengths <= 0 || Vec3f::DotProduct(normalBefore, normalAfter) < 0.2f * lengths) {
+        return -1;
+      }
+      if (checkUvs) {
+        auto uvArea = [](const Vec2f* uv) {
+          return (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) -
+              (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+        };
+        if (uvArea(uvBefore) * uvArea(uvAfter) < 0) {
+          return -1;
+        }
+      }
+    }
+    // the only positions around both ends of the edge must be those across its two triangles
+    const std::vector<int> aroundTarget = neighbours(target);
+    std::vector<int> common;
+    std::set_intersection(
+        around.begin(),
+        around.end(),
+        aroundTarget.begin(),
+        aroundTarget.end(),
+        std::back_inserter(common));
+    if (sharedTriangles != 2 || common.size() != 2) {
+      return -1;
+    }
+
+    double cost = quadrics[u].Error(vertices[v].position);
+    if (checkSkin) {
+      const float edgeLength = (vertices[v].position - vertices[u].position).Length();
+      cost += skinDistance(vertices[u], vertices[v]) * areas[u] * edgeLength * edgeLength;
+    }
+    return cost;
+  };
+
+  struct Collapse {
+    double cost;
+    int u;
+    int v;
+    int version;
+    bool operator>(const Collapse& other) const {
+      return cost > other.cost;
+    }
+  };
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+  std::vector<int> versions(vertexCount, 0);
+  std::vector<bool> removed(vertexCount, false);
+  // queue up the cheapest collapse of vertex u, if it has any
+  auto enqueue = [&](int u) {
+    if (locked[u] || removed[u]) {
+      return;
+    }
+    Collapse best = {-1, u, -1, versions[u]};
+    const std::vector<int> around = neighbours(u);
+    for (const int tt : adjacency[u]) {
+      if (!alive[tt]) {
+        continue;
+      }
+      // u's fan is closed, so each neighbour follows it in exactly one triangle
+      const int* verts = triangles[tt].verts;
+      const int v = verts[0] == u ? verts[1] : (verts[1] == u ? verts[2] : verts[0]);
+      const double cost = collapseCost(u, around, v);
+      if (cost >= 0 && (best.v < 0 || cost < best.cost)) {
+        best.cost = cost;
+        best.v = v;
+      }
+    }
+    if (best.v >= 0) {
+      queue.push(best);
+    }
+  };
+  for (int vv = 0; vv < vertexCount; vv++) {
+    enqueue(vv);
+  }
+
+  size_t aliveCount = triangles.size();
+  while (aliveCount > targetCount && !queue.empty()) {
+    const Collapse collapse = queue.top();
+    queue.pop();
+    const int u = collapse.u;
+    if (removed[u] || collapse.version != versions[u]) {
       continue;
     }
-    RawVertex& vertex = vertices[vertIx];
-    if (vertex.normal.LengthSquared() < FLT_MIN) {
-      vertex.normal = vertex.position - averagePos;
-      if (vertex.normal.LengthSquared() < FLT_MIN) {
-        vertex.normal = Vec3f{0.0f, 1.0f, 0.0f};
+    // collapses elsewhere may have made this one more expensive, or impossible
+    const double cost = collapseCost(u, neighbours(u), collapse.v);
+    if (cost < 0 || cost > collapse.cost * (1 + 1e-6) + 1e-12) {
+      versions[u]++;
+      enqueue(u);
+      continue;
+    }
+    const int target = weld[collapse.v];
+    if (aliveCount <= 2) {
+      // there would be nothing left
+      break;
+    }
+
+    for (const int tt : adjacency[u]) {
+      if (!alive[tt]) {
         continue;
       }
+      if (contains(tt, target)) {
+        alive[tt] = false;
+        aliveCount--;
+      } else {
+        for (int jj = 0; jj < 3; jj++) {
+          if (triangles[tt].verts[jj] == u) {
+            triangles[tt].verts[jj] = collapse.v;
+          }
+        }
+        adjacency[target].push_back(tt);
+      }
+    }
+    adjacency[u].clear();
+    std::vector<int>& targetAdjacency = adjacency[target];
+    targetAdjacency.erase(
+        std::remove_if(
+            targetAdjacency.begin(),
+            targetAdjacency.end(),
+            [&alive](int tt) { return !alive[tt]; }),
+        targetAdjacency.end());
+    removed[u] = true;
+    quadrics[target].Add(quadrics[u]);
+    areas[target] += areas[u];
+
+    // the collapses of the vertices around the target have all changed
+    versions[target]++;
+    enqueue(target);
+    for (const int neighbour : neighbours(target)) {
+      versions[neighbour]++;
+      enqueue(neighbour);
+    }
+  }
+
+  size_t kept = 0;
+  for (int tt = 0; tt < triangleCount; tt++) {
+    if (alive[tt]) {
+      triangles[kept++] = triangles[tt];
+    }
+  }
+  triangles.resize(kept);
+}
+
+void RawModel::CreateLevelsOfDetail(
+    const std::vector<RawModel>& materialModels,
+    const std::vector<float>& ratios,
+    std::vector<std::vector<RawModel>>& lodModels) const {
+  lodModels.assign(ratios.size(), std::vector<RawModel>(materialModels.size()));
+  ParallelUtils::ForEach(materialModels.size(), [&](size_t modelIx) {
+    // each level is simplified further from the one before it, which is much faster than starting
+    // over from the full model every time
+    RawModel model = materialModels[modelIx];
+    const size_t triangleCount = model.triangles.size();
+    for (size_t level = 0; level < ratios.size(); level++) {
+      const size_t targetCount =
+          std::max<size_t>(1, (size_t)std::ceil(ratios[level] * triangleCount));
+      simplifyTriangles(model.triangles, model.vertices, model.vertexAttributes, targetCount);
+
+      RawModel& lodModel = lodModels[level][modelIx];
+      lodModel = model;
+      lodModel.OptimizeVertexFetch();
+      RawSurface& surface = lodModel.surfaces[0];
+      surface.bounds.Clear();
+      for (const RawVertex& vertex : lodModel.vertices) {
+        surface.bounds.AddPoint(vertex.position);
+      }
+    }
+  });
+
+  if (verboseOutput) {
+    size_t triangleCount = 0;
+    for (const RawModel& model : materialModels) {
+      triangleCount += model.triangles.size();
+    }
+    for (size_t level = 0; level < ratios.size(); level++) {
+      size_t lodTriangleCount = 0;
+      for (const RawModel& model : lodModels[level]) {
+        lodTriangleCount += model.triangles.size();
+      }
+      fmt::printf(
+          "Level of detail %zu: %zu triangles, %.1f%% of %zu (aiming for %.1f%%)\n",
+          level + 1,
+          lodTriangleCount,
+          100.0 * lodTriangleCount / std::max<size_t>(1, triangleCount),
+          triangleCount,
+          100.0 * ratios[level]);
     }
-    vertex.normal.Normalize();
   }
-  return onlyBroken ? brokenVerts.size() : vertices.size();
 }
@@ -301,6 +301,8 @@ struct RawChannel {
   std::vector<Quatf> rotations;
   std::vector<Vec3f> scales;
   std::vector<float> weights;
+  // if non-empty, the weights are keyed at these times rather than at every one of the animation's
+  std::vector<float> weightTimes;
 };
 
 struct RawAnimation {
@@ -405,15 +407,27 @@ class RawModel {
     return rootNodeId;
   }
 
+  // Remove triangles that repeat a vertex, have no area, or duplicate another triangle of their
+  // surface and material, one surface at a time in parallel. Returns how many were removed; follow
+  // up with Condense() to drop what they alone used.
+  size_t CleanTriangles();
+
   // Remove unused vertices, textures or materials after removing vertex attributes, textures,
   // materials or surfaces.
   void Condense();
 
-  void TransformGeometry(ComputeNormalsOption);
+  void TransformGeometry(
+      ComputeNormalsOption normals,
+      NormalWeightingOption weighting,
+      float smoothingAngle);
 
   void TransformTextures(const std::vector<std::function<Vec2f(Vec2f)>>& transforms);
 
-  size_t CalculateNormals(bool);
+  // Compute the normals of all vertices, or only of those whose normals are empty, from the faces
+  // around their positions, in parallel. Below a smoothing angle of 180 degrees, faces further
+  // apart than that don't smooth each other, and vertices on such hard edges are split. Returns
+  // how many vertices got new normals.
+  size_t CalculateNormals(bool onlyBroken, NormalWeightingOption weighting, float smoothingAngle);
 
   // Get the attributes stored per vertex.
   int GetVertexAttributes() const {
@@ -515,8 +529,40 @@ class RawModel {
       const int keepAttribs,
       const bool forceDiscrete) const;
 
+  // Weld the near-identical vertices of each of the given material models, in parallel: those no
+  // further apart than positionTolerance (a fraction of the bounding box diagonal of the surface
+  // the model belongs to), with normals, tangents and binormals no more than normalAngle degrees
+  // apart, UVs no further apart than uvTolerance, and the same UV polarity, tangent handedness and
+  // skinning. Triangles left without area are dropped, as are models left without triangles.
+  void WeldMaterialModels(
+      std::vector<RawModel>& materialModels,
+      float positionTolerance,
+      float normalAngle,
+      float uvTolerance) const;
+
+  // Optimize each of the given material models for the GPU, in parallel. With vertexCache, the
+  // triangles are reordered to make the most of the post-transform vertex cache; transparent ones
+  // keep their order. With vertexFetch, the vertices are then renumbered in the order the triangles
+  // first use them.
+  void OptimizeMaterialModels(
+      std::vector<RawModel>& materialModels,
+      bool vertexCache,
+      bool vertexFetch) const;
+
+  // Renumber the vertices in the order in which the triangles first use them, dropping any unused.
+  void OptimizeVertexFetch();
+
+  // Simplify copies of the given material models, in parallel, once for each ratio of triangles
+  // to keep: lodModels[level][modelIx] is materialModels[modelIx] at ratios[level]. Seams, borders
+  // and the attributes of the vertices that remain are kept intact.
+  void CreateLevelsOfDetail(
+      const std::vector<RawModel>& materialModels,
+      const std::vector<float>& ratios,
+      std::vector<std::vector<RawModel>>& lodModels) const;
+
  private:
-  Vec3f getFaceNormal(int verts[3]) const;
+  // whether a triangle of the given model (this one, or one of its material models) is blended
+  bool isTransparent(const RawModel& model, const RawTriangle& triangle) const;
 
   long rootNodeId;
   int vertexAttributes;
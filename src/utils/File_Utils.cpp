@@ -16,6 +16,14 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "FBX2glTF.h"
 #include "String_Utils.hpp"
 
@@ -52,7 +60,87 @@ bool CreatePath(const std::string path) {
   return boost::filesystem::create_directory(parent);
 }
 
-bool CopyFile(const std::string& srcFilename, const std::string& dstFilename, bool createPath) {
+// whether dstFilename is a copy of srcFilename that an earlier CopyFile() left behind, or (in the
+// case of a texture that already lives in the output folder, say) the very same file
+static bool isUpToDateCopy(const std::string& srcFilename, const std::string& dstFilename) {
+  boost::system::error_code ec;
+  if (!boost::filesystem::is_regular_file(boost::filesystem::symlink_status(dstFilename, ec))) {
+    return false;
+  }
+  if (boost::filesystem::equivalent(srcFilename, dstFilename, ec)) {
+    return true;
+  }
+  const auto srcSize = boost::filesystem::file_size(srcFilename, ec);
+  const auto dstSize = ec ? 0 : boost::filesystem::file_size(dstFilename, ec);
+  const auto srcTime = ec ? 0 : boost::filesystem::last_write_time(srcFilename, ec);
+  const auto dstTime = ec ? 0 : boost::filesystem::last_write_time(dstFilename, ec);
+  return !ec && srcSize == dstSize && srcTime == dstTime;
+}
+
+// get rid of whatever is at dstFilename, so that we never write through a link into its target;
+// but never of the source file itself, when it's already where it's meant to go
+static bool prepareDestination(
+    const std::string& srcFilename,
+    const std::string& dstFilename,
+    bool createPath) {
+  if (createPath && !CreatePath(dstFilename.c_str())) {
+    fmt::printf("Warning: Couldn't create directory %s.\n", dstFilename);
+    return false;
+  }
+  boost::system::error_code ec;
+  if (boost::filesystem::equivalent(srcFilename, dstFilename, ec)) {
+    fmt::printf("Warning: Won't replace %s with itself.\n", dstFilename);
+    return false;
+  }
+  boost::filesystem::remove(dstFilename, ec);
+  if (ec) {
+    fmt::printf("Warning: Couldn't replace existing file %s.\n", dstFilename);
+    return false;
+  }
+  return true;
+}
+
+// copying is done; give the copy its source's modification time, for isUpToDateCopy()
+static void finishCopy(const std::string& srcFilename, const std::string& dstFilename) {
+  boost::system::error_code ec;
+  const auto srcTime = boost::filesystem::last_write_time(srcFilename, ec);
+  if (!ec) {
+    boost::filesystem::last_write_time(dstFilename, srcTime, ec);
+  }
+}
+
+#if defined(__linux__)
+// let the kernel do the copying (server-side, or even copy-on-write, where supported)
+static bool copyFileRange(const std::string& srcFilename, const std::string& dstFilename) {
+  const int srcFd = open(srcFilename.c_str(), O_RDONLY);
+  if (srcFd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(srcFd, &info) != 0) {
+    close(srcFd);
+    return false;
+  }
+  const int dstFd = open(dstFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, info.st_mode & 0777);
+  if (dstFd < 0) {
+    close(srcFd);
+    return false;
+  }
+  off_t remaining = info.st_size;
+  while (remaining > 0) {
+    const ssize_t copied = copy_file_range(srcFd, nullptr, dstFd, nullptr, remaining, 0);
+    if (copied <= 0) {
+      break;
+    }
+    remaining -= copied;
+  }
+  close(dstFd);
+  close(srcFd);
+  return remaining == 0;
+}
+#endif
+
+static bool streamCopyFile(const std::string& srcFilename, const std::string& dstFilename) {
   std::ifstream srcFile(srcFilename, std::ios::binary);
   if (!srcFile) {
     fmt::printf("Warning: Couldn't open file %s for reading.\n", srcFilename);
@@ -63,11 +151,6 @@ bool CopyFile(const std::string& srcFilename, const std::string& dstFilename, bo
   std::streamsize srcSize = srcFile.tellg();
   srcFile.seekg(0, std::ios::beg);
 
-  if (createPath && !CreatePath(dstFilename.c_str())) {
-    fmt::printf("Warning: Couldn't create directory %s.\n", dstFilename);
-    return false;
-  }
-
   std::ofstream dstFile(dstFilename, std::ios::binary | std::ios::trunc);
   if (!dstFile) {
     fmt::printf("Warning: Couldn't open file %s for writing.\n", dstFilename);
@@ -86,4 +169,103 @@ bool CopyFile(const std::string& srcFilename, const std::string& dstFilename, bo
       srcSize);
   return false;
 }
+
+bool CopyFile(const std::string& srcFilename, const std::string& dstFilename, bool createPath) {
+  if (isUpToDateCopy(srcFilename, dstFilename)) {
+    if (verboseOutput) {
+      fmt::printf("Skipping unchanged file %s.\n", dstFilename);
+    }
+    return true;
+  }
+  if (!prepareDestination(srcFilename, dstFilename, createPath)) {
+    return false;
+  }
+  bool success = false;
+#if defined(__linux__)
+  success = copyFileRange(srcFilename, dstFilename);
+#endif
+  if (!success) {
+    success = streamCopyFile(srcFilename, dstFilename);
+  }
+  if (success) {
+    finishCopy(srcFilename, dstFilename);
+  }
+  return success;
+}
+
+bool CloneFile(const std::string& srcFilename, const std::string& dstFilename, bool createPath) {
+#if defined(__linux__) && defined(FICLONE)
+  if (isUpToDateCopy(srcFilename, dstFilename)) {
+    if (verboseOutput) {
+      fmt::printf("Skipping unchanged file %s.\n", dstFilename);
+    }
+    return true;
+  }
+  if (!prepareDestination(srcFilename, dstFilename, createPath)) {
+    return false;
+  }
+  bool success = false;
+  const int srcFd = open(srcFilename.c_str(), O_RDONLY);
+  if (srcFd >= 0) {
+    const int dstFd = open(dstFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dstFd >= 0) {
+      success = ioctl(dstFd, FICLONE, srcFd) == 0;
+      close(dstFd);
+    }
+    close(srcFd);
+  }
+  if (success) {
+    finishCopy(srcFilename, dstFilename);
+    return true;
+  }
+#endif
+  // the file system can't share extents between these files; fall back to a plain copy
+  return CopyFile(srcFilename, dstFilename, createPath);
+}
+
+bool HardLinkFile(
+    const std::string& srcFilename,
+    const std::string& dstFilename,
+    bool createPath) {
+  boost::system::error_code ec;
+  if (boost::filesystem::equivalent(srcFilename, dstFilename, ec)) {
+    if (verboseOutput) {
+      fmt::printf("Skipping existing link %s.\n", dstFilename);
+    }
+    return true;
+  }
+  if (!prepareDestination(srcFilename, dstFilename, createPath)) {
+    return false;
+  }
+  boost::filesystem::create_hard_link(srcFilename, dstFilename, ec);
+  if (!ec) {
+    return true;
+  }
+  // e.g. the output folder is on a different file system
+  return CopyFile(srcFilename, dstFilename, createPath);
+}
+
+bool SymlinkFile(const std::string& srcFilename, const std::string& dstFilename, bool createPath) {
+  const boost::filesystem::path target = boost::filesystem::absolute(srcFilename);
+  boost::system::error_code ec;
+  // the source may already be at the destination, e.g. a texture that lives in the output folder
+  if (boost::filesystem::equivalent(srcFilename, dstFilename, ec) ||
+      (boost::filesystem::is_symlink(boost::filesystem::symlink_status(dstFilename, ec)) &&
+       boost::filesystem::read_symlink(dstFilename, ec) == target && !ec)) {
+    if (verboseOutput) {
+      fmt::printf("Skipping existing link %s.\n", dstFilename);
+    }
+    return true;
+  }
+  if (!prepareDestination(srcFilename, dstFilename, createPath)) {
+    return false;
+  }
+  boost::filesystem::create_symlink(target, dstFilename, ec);
+  if (!ec) {
+    return true;
+  }
+  // e.g. no symlink privileges on Windows
+  return CopyFile(srcFilename, dstFilename, createPath);
+}
+
 } // namespace FileUtils
@@ -28,11 +28,37 @@ std::vector<std::string> ListFolderFiles(
 
 bool CreatePath(std::string path);
 
+/**
+ * Copy a file, unless the destination already is an unchanged copy of it: copies are given the
+ * source's modification time, and a destination of the same size and modification time is left
+ * alone. Anything else at the destination is replaced, never written through.
+ */
 bool CopyFile(
     const std::string& srcFilename,
     const std::string& dstFilename,
     bool createPath = false);
 
+/**
+ * Like CopyFile(), but share the source's storage copy-on-write where the file system allows
+ * (e.g. btrfs, XFS), which is near-instant whatever the size. Otherwise, falls back to copying.
+ */
+bool CloneFile(
+    const std::string& srcFilename,
+    const std::string& dstFilename,
+    bool createPath = false);
+
+/** Hard-link the destination to the source, or fall back to CopyFile() if that's impossible. */
+bool HardLinkFile(
+    const std::string& srcFilename,
+    const std::string& dstFilename,
+    bool createPath = false);
+
+/** Make the destination a symlink to the source's absolute path, or else fall back to a copy. */
+bool SymlinkFile(
+    const std::string& srcFilename,
+    const std::string& dstFilename,
+    bool createPath = false);
+
 inline std::string GetAbsolutePath(const std::string& filePath) {
   return boost::filesystem::absolute(filePath).string();
 }
@@ -0,0 +1,148 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Hash_Utils.hpp"
+
+#include <fstream>
+#include <vector>
+
+namespace HashUtils {
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// byte-wise little-endian reads, so that hashes are the same on every host; compilers turn them
+// into plain loads on little-endian ones
+static inline uint32_t read32(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+  return (uint64_t)read32(p) | (uint64_t)read32(p + 4) << 32;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  return rotl(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+// the four lanes that inputs of 32 bytes or more are mixed into, a stripe at a time
+static inline void initLanes(uint64_t lanes[4], uint64_t seed) {
+  lanes[0] = seed + PRIME64_1 + PRIME64_2;
+  lanes[1] = seed + PRIME64_2;
+  lanes[2] = seed;
+  lanes[3] = seed - PRIME64_1;
+}
+
+static inline void consumeStripe(uint64_t lanes[4], const uint8_t* p) {
+  // four independent lanes, so the multiplies can overlap
+  lanes[0] = round(lanes[0], read64(p));
+  lanes[1] = round(lanes[1], read64(p + 8));
+  lanes[2] = round(lanes[2], read64(p + 16));
+  lanes[3] = round(lanes[3], read64(p + 24));
+}
+
+static inline uint64_t mergeLanes(const uint64_t lanes[4]) {
+  uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+  for (int ii = 0; ii < 4; ii++) {
+    h = mergeRound(h, lanes[ii]);
+  }
+  return h;
+}
+
+// mix in the last (fewer than 32) bytes, and avalanche
+static uint64_t finish(uint64_t h, const uint8_t* p, const uint8_t* end) {
+  for (; p + 8 <= end; p += 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * PRIME64_1;
+    h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= (*p) * PRIME64_5;
+    h = rotl(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t Hash64(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = p + size;
+
+  uint64_t h;
+  if (size >= 32) {
+    uint64_t lanes[4];
+    initLanes(lanes, seed);
+    for (; end - p >= 32; p += 32) {
+      consumeStripe(lanes, p);
+    }
+    h = mergeLanes(lanes);
+  } else {
+    h = seed + PRIME64_5;
+  }
+  h += (uint64_t)size;
+  return finish(h, p, end);
+}
+
+// files are hashed a block at a time, so that hashing many at once doesn't hold them all in memory
+static const size_t HASH_FILE_BLOCK_SIZE = 1 << 16;
+static_assert(HASH_FILE_BLOCK_SIZE % 32 == 0, "blocks must hold whole stripes");
+
+bool HashFile(const std::string& path, uint64_t& hash, uint64_t& size) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::vector<char> block(HASH_FILE_BLOCK_SIZE);
+  uint64_t lanes[4];
+  initLanes(lanes, 0);
+  uint64_t total = 0;
+  for (;;) {
+    file.read(block.data(), block.size());
+    if (file.bad()) {
+      return false;
+    }
+    const size_t count = static_cast<size_t>(file.gcount());
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(block.data());
+    const uint8_t* const end = p + count;
+    total += count;
+    for (; end - p >= 32; p += 32) {
+      consumeStripe(lanes, p);
+    }
+    if (count < block.size()) {
+      // a short read means we've reached the end; whatever is left of this block is the tail
+      const uint64_t h = (total >= 32 ? mergeLanes(lanes) : PRIME64_5) + total;
+      hash = finish(h, p, end);
+      size = total;
+      return true;
+    }
+  }
+}
+
+} // namespace HashUtils
@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace HashUtils {
+
+/**
+ * A fast, non-cryptographic 64-bit hash of a block of memory (XXH64). Good for spotting identical
+ * content; a match should still be confirmed by comparing bytes where a collision would matter.
+ */
+uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0);
+
+/**
+ * Compute the Hash64() of an entire file's contents, and report its size along with it. Returns
+ * false if the file could not be read.
+ */
+bool HashFile(const std::string& path, uint64_t& hash, uint64_t& size);
+
+} // namespace HashUtils
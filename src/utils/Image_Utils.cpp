@@ -9,8 +9,13 @@
 #include "Image_Utils.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <mutex>
 #include <string>
 
+#include <encoder/basisu_comp.h>
+
 #define STB_IMAGE_IMPLEMENTATION
 
 #include <stb_image.h>
@@ -21,6 +26,9 @@
 
 namespace ImageUtils {
 
+// the ETC1S quality level KTX2 textures are encoded at, from 1 to 255; basisu's own default
+static const uint32_t KTX2_ETC1S_QUALITY = 128;
+
 static bool imageHasTransparentPixels(FILE* f) {
   int width, height, channels;
   // RGBA: we have to load the pixels to figure out if the image is fully opaque
@@ -70,4 +78,171 @@ std::string suffixToMimeType(std::string suffix) {
   return "image/unknown";
 }
 
+static float srgbToLinear(float v) {
+  return (v <= 0.04045f) ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float v) {
+  return (v <= 0.0031308f) ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// the source samples that make up one destination sample, and how much each of them contributes
+struct Contribution {
+  int first;
+  std::vector<float> weights;
+};
+
+static std::vector<Contribution> computeContributions(int srcSize, int dstSize) {
+  std::vector<Contribution> result(dstSize);
+  const double scale = (double)srcSize / dstSize;
+  for (int ii = 0; ii < dstSize; ii++) {
+    // destination sample ii covers the source interval [lo, hi)
+    const double lo = ii * scale;
+    const double hi = (ii + 1) * scale;
+    const int last = std::min(srcSize - 1, (int)std::ceil(hi) - 1);
+    result[ii].first = (int)lo;
+    for (int jj = result[ii].first; jj <= last; jj++) {
+      const double overlap = std::min(hi, jj + 1.0) - std::max(lo, (double)jj);
+      result[ii].weights.push_back((float)(overlap / scale));
+    }
+  }
+  return result;
+}
+
+std::vector<uint8_t> ResizeImage(
+    const uint8_t* pixels,
+    int width,
+    int height,
+    int channels,
+    int newWidth,
+    int newHeight,
+    ImageColorSpace colorSpace) {
+  assert(newWidth > 0 && newWidth <= width && newHeight > 0 && newHeight <= height);
+  const bool hasAlpha = (channels == 2 || channels == 4);
+  const int colorChannels = hasAlpha ? channels - 1 : channels;
+
+  float toLinear[256];
+  for (int ii = 0; ii < 256; ii++) {
+    toLinear[ii] = (colorSpace == IMAGE_SRGB) ? srgbToLinear(ii / 255.0f) : ii / 255.0f;
+  }
+
+  // decode to linear, alpha-premultiplied floats
+  const size_t srcRowLength = (size_t)width * channels;
+  std::vector<float> src(srcRowLength * height);
+  for (size_t ix = 0; ix < (size_t)width * height; ix++) {
+    const uint8_t* in = &pixels[ix * channels];
+    float* out = &src[ix * channels];
+    const float alpha = hasAlpha ? in[colorChannels] / 255.0f : 1.0f;
+    for (int cc = 0; cc < colorChannels; cc++) {
+      out[cc] = toLinear[in[cc]] * alpha;
+    }
+    if (hasAlpha) {
+      out[colorChannels] = alpha;
+    }
+  }
+
+  // vertical pass; every output row is a weighted sum of whole input rows, which is a simple
+  // multiply-add over contiguous memory that the compiler vectorizes for us
+  const std::vector<Contribution> rows = computeContributions(height, newHeight);
+  std::vector<float> tmp(srcRowLength * newHeight, 0.0f);
+  for (int yy = 0; yy < newHeight; yy++) {
+    float* out = &tmp[yy * srcRowLength];
+    for (size_t kk = 0; kk < rows[yy].weights.size(); kk++) {
+      const float weight = rows[yy].weights[kk];
+      const float* in = &src[(rows[yy].first + kk) * srcRowLength];
+      for (size_t ii = 0; ii < srcRowLength; ii++) {
+        out[ii] += weight * in[ii];
+      }
+    }
+  }
+
+  // horizontal pass
+  const std::vector<Contribution> columns = computeContributions(width, newWidth);
+  const size_t dstRowLength = (size_t)newWidth * channels;
+  std::vector<float> dst(dstRowLength * newHeight, 0.0f);
+  for (int yy = 0; yy < newHeight; yy++) {
+    const float* in = &tmp[yy * srcRowLength];
+    float* out = &dst[yy * dstRowLength];
+    for (int xx = 0; xx < newWidth; xx++) {
+      for (size_t kk = 0; kk < columns[xx].weights.size(); kk++) {
+        const float weight = columns[xx].weights[kk];
+        const float* sample = &in[(columns[xx].first + kk) * channels];
+        for (int cc = 0; cc < channels; cc++) {
+          out[xx * channels + cc] += weight * sample[cc];
+        }
+      }
+    }
+  }
+
+  // un-premultiply, renormalize, re-encode
+  std::vector<uint8_t> result(dst.size());
+  for (size_t ix = 0; ix < (size_t)newWidth * newHeight; ix++) {
+    float* pixel = &dst[ix * channels];
+    const float alpha = hasAlpha ? pixel[colorChannels] : 1.0f;
+    for (int cc = 0; cc < colorChannels; cc++) {
+      pixel[cc] = (alpha > 0.0f) ? pixel[cc] / alpha : 0.0f;
+    }
+    if (colorSpace == IMAGE_NORMAL_MAP && colorChannels >= 3) {
+      float nx = pixel[0] * 2.0f - 1.0f;
+      float ny = pixel[1] * 2.0f - 1.0f;
+      float nz = pixel[2] * 2.0f - 1.0f;
+      const float length = sqrtf(nx * nx + ny * ny + nz * nz);
+      if (length > 0.0f) {
+        pixel[0] = (nx / length + 1.0f) / 2.0f;
+        pixel[1] = (ny / length + 1.0f) / 2.0f;
+        pixel[2] = (nz / length + 1.0f) / 2.0f;
+      }
+    }
+    for (int cc = 0; cc < channels; cc++) {
+      float value = std::max(0.0f, std::min(1.0f, pixel[cc]));
+      if (colorSpace == IMAGE_SRGB && cc < colorChannels) {
+        value = linearToSrgb(value);
+      }
+      result[ix * channels + cc] = static_cast<uint8_t>(lroundf(value * 255.0f));
+    }
+  }
+  return result;
+}
+
+bool EncodeKtx2(
+    const uint8_t* pixels,
+    int width,
+    int height,
+    int channels,
+    ImageColorSpace colorSpace,
+    bool uastc,
+    bool mipmaps,
+    std::vector<char>& ktx2) {
+  static std::once_flag encoderInitialized;
+  std::call_once(encoderInitialized, []() { basisu::basisu_encoder_init(); });
+
+  basisu::vector<basisu::image> sourceImages(1);
+  sourceImages[0].init(pixels, (uint32_t)width, (uint32_t)height, (uint32_t)channels);
+
+  // each call encodes on the calling thread; callers parallelise across images instead
+  uint32_t flags = basisu::cFlagKTX2;
+  if (uastc) {
+    flags |= basisu::cFlagUASTC | basisu::cFlagKTX2UASTCSuperCompression |
+        basisu::cPackUASTCLevelDefault;
+  } else {
+    // the quality level goes in the low bits of the flags
+    flags |= KTX2_ETC1S_QUALITY;
+  }
+  if (colorSpace == IMAGE_SRGB) {
+    flags |= basisu::cFlagSRGB;
+  }
+  if (mipmaps) {
+    flags |= basisu::cFlagGenMipsClamp;
+  }
+
+  size_t size = 0;
+  void* data = basisu::basis_compress(sourceImages, flags, 0.0f, &size);
+  if (data == nullptr) {
+    return false;
+  }
+  ktx2.assign(static_cast<const char*>(data), static_cast<const char*>(data) + size);
+  basisu::basis_free_data(data);
+  return true;
+}
+
 } // namespace ImageUtils
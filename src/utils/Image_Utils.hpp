@@ -8,7 +8,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace ImageUtils {
 
@@ -28,4 +30,42 @@ ImageProperties GetImageProperties(char const* filePath);
  */
 std::string suffixToMimeType(std::string suffix);
 
+/**
+ * How the channels of an 8-bit image should be interpreted while resampling it.
+ */
+enum ImageColorSpace {
+  IMAGE_LINEAR, // plain data, e.g. roughness or occlusion
+  IMAGE_SRGB, // colour channels are sRGB-encoded; alpha (if any) is always linear
+  IMAGE_NORMAL_MAP, // RGB encodes a unit vector as (n + 1) / 2
+};
+
+/**
+ * Resample an 8-bit image of the given channel count down to newWidth x newHeight, using an
+ * area-weighted box filter. Filtering happens in linear space, on alpha-premultiplied values when
+ * there is an alpha channel; normal maps are renormalized afterwards. Upscaling is not supported.
+ */
+std::vector<uint8_t> ResizeImage(
+    const uint8_t* pixels,
+    int width,
+    int height,
+    int channels,
+    int newWidth,
+    int newHeight,
+    ImageColorSpace colorSpace);
+
+/**
+ * Transcode an 8-bit image to a KTX2 container of Basis Universal data, for KHR_texture_basisu.
+ * ETC1S gives the smallest files; UASTC (zstd-supercompressed) keeps much more detail, and is the
+ * better choice for normal maps. Optionally generates a full mip chain. Returns false on failure.
+ */
+bool EncodeKtx2(
+    const uint8_t* pixels,
+    int width,
+    int height,
+    int channels,
+    ImageColorSpace colorSpace,
+    bool uastc,
+    bool mipmaps,
+    std::vector<char>& ktx2);
+
 } // namespace ImageUtils
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ParallelUtils {
+
+/** The number of worker threads to spread parallel work across. */
+inline size_t GetWorkerCount() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Call fn(ix) for every ix in [0, count), on up to GetWorkerCount() threads, and return once all
+ * the calls have completed. Indices are handed out one at a time, so the calls may vary wildly in
+ * cost. The order in which they run is unspecified; fn must only touch state that belongs to ix.
+ */
+template <typename Fn>
+void ForEach(size_t count, const Fn& fn) {
+  const size_t workerCount = std::min(count, GetWorkerCount());
+  if (workerCount <= 1) {
+    for (size_t ix = 0; ix < count; ix++) {
+      fn(ix);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (size_t ii = 0; ii < workerCount; ii++) {
+    workers.emplace_back([&]() {
+      for (size_t ix = next++; ix < count; ix = next++) {
+        fn(ix);
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+} // namespace ParallelUtils
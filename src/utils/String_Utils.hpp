@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -30,4 +31,38 @@ inline int CompareNoCase(const std::string& s1, const std::string& s2) {
   return strncasecmp(s1.c_str(), s2.c_str(), std::max(s1.length(), s2.length()));
 }
 
+/**
+ * Parse a human-readable size such as "512", "64K", "256MB" or "1.5GiB" into a number of bytes.
+ * Multiples are binary (1024-based). Returns false if the string can't be made sense of.
+ */
+inline bool ParseByteSize(const std::string& s, uint64_t& bytes) {
+  size_t end = 0;
+  double value;
+  try {
+    value = std::stod(s, &end);
+  } catch (const std::exception&) {
+    return false;
+  }
+  std::string unit = ToLower(s.substr(end));
+  unit.erase(0, unit.find_first_not_of(' '));
+
+  uint64_t multiplier;
+  if (unit.empty() || unit == "b") {
+    multiplier = 1;
+  } else if (unit == "k" || unit == "kb" || unit == "kib") {
+    multiplier = 1ull << 10;
+  } else if (unit == "m" || unit == "mb" || unit == "mib") {
+    multiplier = 1ull << 20;
+  } else if (unit == "g" || unit == "gb" || unit == "gib") {
+    multiplier = 1ull << 30;
+  } else {
+    return false;
+  }
+  if (value < 0) {
+    return false;
+  }
+  bytes = static_cast<uint64_t>(value * multiplier);
+  return true;
+}
+
 } // namespace StringUtils